@@ -0,0 +1,192 @@
+module;
+
+#include <assert.h>
+#include <torch/torch.h>
+
+export module az:analysis;
+
+import std;
+
+import :evaluator;
+import :game;
+import :mcts;
+import :model;
+import :task;
+import :trace;
+
+namespace az {
+
+// Answers independent analysis requests, evaluations of a position by the
+// model or searches from it, for many clients at once. Every worker thread
+// keeps up to `max_in_flight` requests running as coroutines that share one
+// batched evaluator, like the self-play actors do, so the leaves of all the
+// searches in flight go through the same forward passes.
+//
+// Waiting requests start by priority, then by deadline, then in the order
+// they were submitted. Once started, requests share the forward passes
+// equally.
+export template <concepts::Game Game, concepts::Model Model>
+class AnalysisPool {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using LegalForward = BatchEvaluator<Model>::LegalForward;
+
+  struct Config {
+    int32_t num_workers = 1;
+    int32_t max_in_flight = 64;
+  };
+
+  struct Request {
+    Game::State state;
+    // Only evaluates the position with the model when 0.
+    int32_t num_simulations = 0;
+    // Requests with a higher priority start first.
+    int32_t priority = 0;
+    // A request that has not started by its deadline fails, a search still
+    // running at its deadline answers with what it found so far.
+    std::optional<Clock::time_point> deadline = std::nullopt;
+  };
+
+  struct Result {
+    // The model's win, draw and loss probabilities, only set by evaluations.
+    std::optional<torch::Tensor> wdl;
+    // The model's policy for evaluations, the root visit distribution for
+    // searches, over every action.
+    torch::Tensor policy;
+    int32_t num_simulations = 0;
+  };
+
+  // `make_forward` is called once on every worker thread, so that a forward
+  // pass that is not thread safe can have one instance per worker.
+  AnalysisPool(std::function<LegalForward()> make_forward, Config config)
+      : config_(config) {
+    for (auto worker : std::views::iota(0, config_.num_workers)) {
+      workers_.emplace_back([this, make_forward, worker] {
+        trace::name_thread(std::format("analysis worker {}", worker));
+        run(make_forward());
+      });
+    }
+  }
+
+  AnalysisPool(const AnalysisPool&) = delete;
+  auto operator=(const AnalysisPool&) -> AnalysisPool& = delete;
+
+  // Requests still waiting fail, requests in flight finish first.
+  ~AnalysisPool() {
+    {
+      auto guard = std::lock_guard(mutex_);
+      is_stopping_ = true;
+    }
+    has_work_.notify_all();
+    workers_.clear();
+
+    for (auto& [_, pending] : waiting_)
+      pending.result.set_exception(std::make_exception_ptr(
+          std::runtime_error("The analysis pool was stopped.")));
+  }
+
+  // The position must not be terminal.
+  auto submit(Request request) -> std::future<Result> {
+    assert(Game::legal_actions(request.state).any().item<bool>());
+
+    auto result = std::promise<Result>{};
+    auto future = result.get_future();
+    {
+      auto guard = std::lock_guard(mutex_);
+      auto key = Key{-request.priority,
+                     request.deadline.value_or(Clock::time_point::max()),
+                     next_sequence_++};
+      waiting_.emplace(key, Pending{std::move(request), std::move(result)});
+    }
+    has_work_.notify_one();
+    return future;
+  }
+
+ private:
+  struct Pending {
+    Request request;
+    std::promise<Result> result;
+  };
+
+  // Negated priority, deadline and submission order.
+  using Key = std::tuple<int32_t, Clock::time_point, uint64_t>;
+
+  auto run(LegalForward forward) -> void {
+    torch::NoGradGuard no_grad;
+    auto evaluator =
+        BatchEvaluator<Model>(std::move(forward), /*is_batched=*/true);
+    auto requests = std::vector<Task<>>{};
+
+    while (true) {
+      {
+        auto lock = std::unique_lock(mutex_);
+        if (requests.empty())
+          has_work_.wait(lock, [this] {
+            return is_stopping_ or not waiting_.empty();
+          });
+        if (requests.empty() and is_stopping_)
+          return;
+
+        // A new request runs until its first leaf evaluation.
+        while (std::ssize(requests) < config_.max_in_flight and
+               not waiting_.empty() and not is_stopping_) {
+          auto node = waiting_.extract(waiting_.begin());
+          lock.unlock();
+          auto pending = std::move(node.mapped());
+          requests.push_back(analyse(std::move(pending), evaluator));
+          requests.back().resume();
+          lock.lock();
+        }
+      }
+
+      evaluator.flush();
+      std::erase_if(requests, [](Task<>& request) {
+        if (not request.is_done())
+          return false;
+        request.result();
+        return true;
+      });
+    }
+  }
+
+  auto analyse(Pending pending, BatchEvaluator<Model>& evaluator) -> Task<> {
+    auto& [request, result] = pending;
+    try {
+      if (request.deadline and Clock::now() >= *request.deadline)
+        throw std::runtime_error("The request expired before it started.");
+
+      if (request.num_simulations == 0) {
+        auto actions = Game::legal_actions(request.state).nonzero().flatten();
+        auto [wdl, policy] = co_await evaluator.evaluate(
+            Game::encode_state(request.state), actions);
+        auto full_policy = torch::zeros(Game::ActionSize, torch::kFloat32);
+        full_policy.index_put_({actions}, policy.to(torch::kFloat32));
+        result.set_value(Result{.wdl = wdl, .policy = full_policy});
+      } else {
+        auto mcts =
+            MCTS<Game, Model>{{.num_simulations = request.num_simulations}};
+        mcts.set_stop_condition(request.deadline);
+        auto policy = co_await mcts.search(request.state, evaluator);
+        result.set_value(
+            Result{.wdl = std::nullopt,
+                   .policy = policy,
+                   .num_simulations = mcts.last_statistics().num_simulations});
+      }
+    } catch (...) {
+      result.set_exception(std::current_exception());
+    }
+  }
+
+  Config config_;
+
+  std::mutex mutex_;
+  std::condition_variable has_work_;
+  std::map<Key, Pending> waiting_;
+  uint64_t next_sequence_ = 0;
+  bool is_stopping_ = false;
+
+  // Last, so that the workers stop before the rest is destroyed.
+  std::vector<std::jthread> workers_;
+};
+
+}  // namespace az
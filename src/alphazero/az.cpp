@@ -9,12 +9,25 @@ export module az;
 
 import std;
 
+export import :analysis;
+export import :book;
+export import :evaluator;
+export import :exchange;
 export import :model;
 export import :game;
+export import :ladder;
 export import :memory;
 export import :mcts;
+export import :metrics;
 export import :node;
+export import :parallel;
+export import :random;
+export import :record;
+export import :scheduler;
 export import :storage;
+export import :task;
+export import :topology;
+export import :trace;
 
 namespace F = torch::nn::functional;
 namespace opt = indicators::option;
@@ -31,6 +44,14 @@ namespace az {
 export template <concepts::Game Game, concepts::Model Model>
 class AlphaZero {
   using State = Game::State;
+  using ReplayMemory = Memory<State>;
+  // The encoded positions of one self-play game with their value and policy
+  // targets, in the argument order of `ReplayMemory::append`.
+  using GameSamples = std::vector<
+      std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, State>>;
+  // A distribution over the actions of a state that is not searched with the
+  // network, e.g. from a classical engine. Called from several threads at once.
+  using ExternalPolicy = std::function<torch::Tensor(const State&)>;
 
   struct Config {
     size_t batch_size = 64;
@@ -38,23 +59,107 @@ class AlphaZero {
     int32_t num_training_epochs = 4;
     int32_t num_training_iterations = 10;
 
+    // Every phase plays `num_*_iterations` games per actor in total, handed
+    // out through work stealing, so a given actor may play more or fewer.
+    // The actor counts are fixed rather than taken from the machine, so that
+    // the number of games and the promotion threshold do not depend on it.
     int32_t num_self_play_actors = 6;
     int32_t num_self_play_iterations = 100;
     int32_t num_self_play_simulations = 60;
+    // Games every self-play actor plays at once as coroutines, their leaf
+    // evaluations are batched into a single forward pass.
+    int32_t num_concurrent_self_play_games = 1;
+    // Search self-play positions with the Gumbel root search instead of PUCT
+    // with Dirichlet noise, which needs far fewer simulations per move.
+    bool use_gumbel_self_play = false;
+    // The self-play games of the first `num_bootstrap_iterations` are played
+    // and labelled by this policy instead of the search, so that the network
+    // does not start from the targets of a random network.
+    ExternalPolicy bootstrap_policy = nullptr;
+    int32_t num_bootstrap_iterations = 0;
 
     int32_t num_evaluation_actors = 5;
     int32_t num_evaluation_iterations = 10;
     int32_t num_evaluation_simulations = 1000;
+    // When set, the trained model also plays the evaluation games against
+    // this fixed-strength opponent, which measures progress on a scale that
+    // does not move with the best model.
+    ExternalPolicy baseline_policy = nullptr;
+    // When set, evaluation games play the moves of this opening book up to
+    // `opening_book_depth` moves instead of searching them.
+    std::optional<std::string> opening_book_path = std::nullopt;
+    int32_t opening_book_depth = 12;
 
     float32_t random_playout_percentage = 0.2;
 
+    // Positions are trained on for as long as they stay in this window, so
+    // every self-play position is used in several iterations. The default
+    // only keeps the latest iteration.
+    ReplayWindow replay_window = {};
+
+    // After self-play, up to `num_reanalyse_positions` positions of the
+    // window whose policy targets were searched by an older best model are
+    // searched again by the best model, without noise, and their targets
+    // replaced. Only useful with a window of more than one iteration, see
+    // `ReplayWindow::reanalysed_fraction` for how they are mixed in batches.
+    int32_t num_reanalyse_positions = 0;
+    int32_t num_reanalyse_simulations = 60;
+
+    // Splits every training batch across this many replicas of the model,
+    // each on its own thread pinned to `cores_per_replica` cores, and sums
+    // their gradients before a single optimizer step. With 0 cores per
+    // replica the machine is divided evenly.
+    int32_t num_training_replicas = 1;
+    int32_t cores_per_replica = 0;
+
+    // Pins every self-play and evaluation actor to `cores_per_actor` cores,
+    // spread over the NUMA nodes, sizes its libtorch pools to match and gives
+    // every node its own copy of the models. With 0 cores per actor the
+    // machine is divided evenly between the actors.
+    bool pin_actors = true;
+    int32_t cores_per_actor = 0;
+
     torch::DeviceType device;
+
+    // When set, performance metrics are appended to this file as JSON lines
+    // every `metrics_interval` and at the end of every phase.
+    std::optional<std::string> metrics_path = std::nullopt;
+    std::chrono::milliseconds metrics_interval{5000};
+
+    // When set, a Chrome trace of every iteration is written to this file.
+    // Only `trace_sample_rate` of the searches, forward passes and training
+    // steps are recorded to keep the overhead low.
+    std::optional<std::string> trace_path = std::nullopt;
+    float32_t trace_sample_rate = 0.01;
+
+    // When set, every self-play and evaluation game is appended to this file
+    // as a `GameRecord`. Self-play moves keep their search policy, so that
+    // the training samples can be encoded again from the records.
+    std::optional<std::string> game_records_path = std::nullopt;
+
+    // Every random stream of a run (initial players, noise, sampled actions,
+    // shuffling and libtorch's generator) is derived from this seed, so a run
+    // can be replayed from it.
+    uint64_t seed = std::random_device{}();
   };
 
+  // Identifies the independent random streams derived from the seed.
+  enum Stream : uint64_t { Shuffle, Torch, SelfPlay, Evaluation };
+  // Splits the evaluation stream by opponent, so that the games against the
+  // baseline do not replay the openings of the games against the best model.
+  enum Opponent : uint64_t { BestModel, Baseline };
+
  public:
-  AlphaZero(Config config,
-            std::mt19937 gen = std::mt19937{std::random_device{}()})
-      : config_(std::move(config)), gen_(std::move(gen)) {}
+  AlphaZero(Config config)
+      : config_(std::move(config)),
+        gen_(make_generator(config_.seed, Stream::Shuffle)),
+        metrics_(config_.metrics_path, config_.metrics_interval) {
+    if (config_.opening_book_path)
+      opening_book_ = OpeningBook<Game>::load(*config_.opening_book_path,
+                                              config_.opening_book_depth);
+    if (config_.game_records_path)
+      records_ = std::make_unique<RecordWriter>(*config_.game_records_path);
+  }
 
   auto learn(Model::Config model_config,
              std::optional<std::shared_ptr<Model>> previous_model =
@@ -66,9 +171,26 @@ class AlphaZero {
     model->to(config_.device);
     best_model->to(config_.device);
 
+    torch::manual_seed(derive_seed(config_.seed, Stream::Torch));
+
     auto optimizer = std::make_shared<torch::optim::AdamW>(model->parameters());
 
+    auto& tracer = trace::Tracer::instance();
+    if (config_.trace_path)
+      tracer.start(*config_.trace_path, config_.trace_sample_rate);
+    trace::name_thread("learn");
+
+    auto num_evaluations = config_.baseline_policy ? 2 : 1;
+
+    auto memory = ReplayMemory{gen_, config_.replay_window};
+    auto& counters = learner_counters();
+    // Incremented with every promotion, so reanalysing only searches the
+    // positions whose targets came from an older best model.
+    auto best_model_version = 0;
+
     for (auto i : std::views::iota(0, config_.num_training_iterations)) {
+      auto iteration_span = trace::Span("iteration");
+
       auto bar = std::make_unique<indicators::ProgressBar>(
           opt::BarWidth{50}, opt::ForegroundColor{colors[i % 6]},
           opt::ShowElapsedTime{true}, opt::ShowRemainingTime{true},
@@ -76,7 +198,7 @@ class AlphaZero {
           opt::MaxProgress{config_.num_self_play_iterations *
                                config_.num_self_play_actors +
                            config_.num_training_epochs +
-                           config_.num_evaluation_iterations *
+                           num_evaluations * config_.num_evaluation_iterations *
                                config_.num_evaluation_actors},
           opt::PrefixText{std::format("Iteration {}/{} ", i + 1,
                                       config_.num_training_iterations)},
@@ -84,16 +206,42 @@ class AlphaZero {
               std::vector<indicators::FontStyle>{indicators::FontStyle::bold}});
       auto bar_id = bars_.push_back(std::move(bar));
 
-      auto memory = Memory{gen_};
+      memory.begin_iteration(i, best_model_version);
 
       bars_[bar_id].set_option(opt::PostfixText{"Generating Self-Play Data"});
-      generate_self_play_data(memory, best_model, bar_id);
+      metrics_.begin_phase(i, "self_play");
+      generate_self_play_data(memory, best_model, i, bar_id);
+      metrics_.end_phase();
+
+      if (config_.num_reanalyse_positions > 0) {
+        bars_[bar_id].set_option(opt::PostfixText{"Reanalysing"});
+        metrics_.begin_phase(i, "reanalyse");
+        reanalyse(memory, best_model);
+        metrics_.end_phase();
+      }
 
       bars_[bar_id].set_option(opt::PostfixText{"Training Model"});
-      auto average_loss = train(memory, model, optimizer, bar_id);
+      metrics_.begin_phase(i, "training");
+      auto average_loss = train(memory, model, optimizer, counters, bar_id);
+      metrics_.end_phase();
 
       bars_[bar_id].set_option(opt::PostfixText{"Evaluating Model"});
-      auto [wins, draws, losses] = evaluate(model, best_model, bar_id);
+      metrics_.begin_phase(i, "evaluation");
+      auto [wins, draws, losses] = evaluate(model, best_model, i, bar_id);
+      metrics_.end_phase();
+
+      auto baseline_results = std::string{};
+      if (config_.baseline_policy) {
+        bars_[bar_id].set_option(opt::PostfixText{"Evaluating Baseline"});
+        metrics_.begin_phase(i, "baseline_evaluation");
+        auto [baseline_wins, baseline_draws, baseline_losses] =
+            evaluate(model, best_model, i, bar_id, config_.baseline_policy);
+        metrics_.end_phase();
+
+        baseline_results = std::format(
+            " - Baseline Wins: {} - Draws: {} - Losses: {}", baseline_wins,
+            baseline_draws, baseline_losses);
+      }
 
       auto did_win =
           wins + draws >
@@ -101,6 +249,7 @@ class AlphaZero {
 
       if (did_win) {
         best_model = utils::clone_model(model);
+        best_model_version++;
         best_model->to(config_.device);
         utils::save_model(model,
                           std::format("models/best_models/model_{}.pt", i));
@@ -109,78 +258,334 @@ class AlphaZero {
       utils::save_model(model, std::format("models/all_models/model_{}.pt", i));
 
       bars_[bar_id].set_option(opt::PostfixText{std::format(
-          "Average Loss: {:.6f} - Wins: {} - Draws: {} - Losses: {}",
-          average_loss, wins, draws, losses)});
+          "Average Loss: {:.6f} - Wins: {} - Draws: {} - Losses: {}{}",
+          average_loss, wins, draws, losses, baseline_results)});
 
       bars_[bar_id].mark_as_completed();
+
+      // Every other thread has been joined at this point.
+      tracer.flush();
     }
 
     return best_model;
   }
 
+  // Trains `student`, usually a smaller model that searches faster, to
+  // predict what `teacher` predicts for `states`: its win, draw and loss
+  // probabilities and its policy over the legal actions. Trains like `learn`
+  // does, for `num_training_epochs`, and returns the average loss.
+  auto distill(std::shared_ptr<Model> teacher, std::shared_ptr<Model> student,
+               std::span<const State> states) -> float32_t {
+    auto span = trace::Span("distill");
+
+    teacher->to(config_.device);
+    student->to(config_.device);
+    teacher->eval();
+
+    torch::manual_seed(derive_seed(config_.seed, Stream::Torch));
+
+    auto memory = ReplayMemory{gen_};
+    {
+      torch::NoGradGuard no_grad;
+      // The teacher has no policy for terminal positions.
+      auto positions = states | std::views::filter([](const State& state) {
+                         return Game::legal_actions(state).any().item<bool>();
+                       }) |
+                       std::ranges::to<std::vector>();
+
+      for (auto batch : positions | std::views::chunk(config_.batch_size)) {
+        auto features = std::vector<torch::Tensor>{};
+        auto legal_actions = std::vector<torch::Tensor>{};
+        for (auto& state : batch) {
+          features.push_back(Game::encode_state(state));
+          legal_actions.push_back(Game::legal_actions(state));
+        }
+
+        auto [wdl, logits] =
+            teacher->forward(torch::stack(features).to(config_.device));
+        auto is_illegal = torch::stack(legal_actions).to(logits.device()) == 0;
+        auto policy = torch::softmax(
+            logits.masked_fill(is_illegal,
+                               -std::numeric_limits<float32_t>::infinity()),
+            1);
+
+        wdl = wdl.to(torch::kCPU, torch::kFloat32);
+        policy = policy.to(torch::kCPU, torch::kFloat32);
+        for (auto [i, state] : std::views::enumerate(batch))
+          memory.append(features[i], wdl[i], policy[i], state);
+      }
+    }
+
+    auto optimizer =
+        std::make_shared<torch::optim::AdamW>(student->parameters());
+
+    auto bar = std::make_unique<indicators::ProgressBar>(
+        opt::BarWidth{50}, opt::ForegroundColor{colors[0]},
+        opt::ShowElapsedTime{true}, opt::ShowRemainingTime{true},
+        opt::ShowPercentage{true},
+        opt::MaxProgress{config_.num_training_epochs *
+                         (memory.size() / config_.batch_size)},
+        opt::PrefixText{"Distilling "},
+        opt::FontStyles{
+            std::vector<indicators::FontStyle>{indicators::FontStyle::bold}});
+    auto bar_id = bars_.push_back(std::move(bar));
+
+    auto average_loss =
+        train(memory, student, optimizer, learner_counters(), bar_id);
+    bars_[bar_id].set_option(opt::PostfixText{
+        std::format("Average Loss: {:.6f}", average_loss)});
+    bars_[bar_id].mark_as_completed();
+
+    return average_loss;
+  }
+
  private:
-  auto generate_self_play_data(Memory& memory, std::shared_ptr<Model> model,
+  auto generate_self_play_data(ReplayMemory& memory,
+                               std::shared_ptr<Model> model, int32_t iteration,
                                int32_t bar_id) -> void {
+    auto span = trace::Span("generate_self_play_data");
+
     model->eval();
 
+    auto placement = actor_placement(config_.num_self_play_actors);
+    auto replicas = std::optional<NodeReplicas<Model>>{};
+    if (not placement.empty())
+      replicas.emplace(model);
+
+    auto num_games =
+        config_.num_self_play_iterations * config_.num_self_play_actors;
+    auto scheduler = GameScheduler(num_games, config_.num_self_play_actors);
+
+    // Generate a sorted list of the games that use random playout.
+    auto phase_gen = make_generator(config_.seed, Stream::SelfPlay, iteration);
+    auto n =
+        static_cast<int32_t>(config_.random_playout_percentage * num_games);
+    auto random_playout_games = std::vector<int32_t>();
+    std::ranges::sample(std::views::iota(0, num_games),
+                        std::back_inserter(random_playout_games), n,
+                        phase_gen);
+
+    // Every game fills its own slot and the slots are appended in game order
+    // once all games are done, so that the memory, and with it the seeded
+    // shuffle, does not depend on the order in which the games finished.
+    auto samples = std::vector<GameSamples>(num_games);
+
     auto threads = std::vector<std::thread>();
-    for (auto _ : std::views::iota(0, config_.num_self_play_actors)) {
-      threads.emplace_back([this, &memory, model, bar_id] {
-        auto mcts = MCTS<Game, Model>{
-            {.num_simulations = config_.num_self_play_simulations}};
+    for (auto actor : std::views::iota(0, config_.num_self_play_actors)) {
+      threads.emplace_back([this, &samples, &placement, &replicas, &scheduler,
+                            &random_playout_games, model, iteration, bar_id,
+                            actor] {
+        trace::name_thread(std::format("self-play actor {}", actor));
+        // Pinned before anything is allocated, so that the search tree is
+        // allocated on the actor's node.
+        if (replicas)
+          pin_thread(placement[actor]);
+        auto actor_model =
+            replicas ? replicas->get(placement[actor].node) : model;
+
+        auto& counters = metrics_.register_thread();
+        auto evaluator =
+            BatchEvaluator<Model>(actor_model, /*is_batched=*/true);
+        auto games = std::vector<Task<>>{};
+
+        // Keeps `num_concurrent_self_play_games` games in flight, a new game
+        // runs until its first leaf evaluation.
+        auto start_games = [&] {
+          while (std::ssize(games) < config_.num_concurrent_self_play_games) {
+            auto game = scheduler.next(actor);
+            if (not game)
+              return;
+
+            auto is_not_random_playout =
+                not std::ranges::binary_search(random_playout_games, *game);
+            games.push_back(play_self_play_game(
+                samples[*game], evaluator, counters, iteration, *game,
+                is_not_random_playout, bar_id));
+            games.back().resume();
+          }
+        };
+
+        torch::NoGradGuard no_grad;
+        start_games();
+        while (not games.empty()) {
+          // Every game in flight is waiting for this batch.
+          if (auto batch_size = evaluator.flush(); batch_size > 0)
+            record_evaluations(counters, 1, batch_size);
+
+          std::erase_if(games, [](Task<>& game) {
+            if (not game.is_done())
+              return false;
+            game.result();
+            return true;
+          });
+          start_games();
+        }
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
 
-        auto num_iterations = config_.num_self_play_iterations;
+    for (auto& game_samples : samples) {
+      for (auto& [feature, value, policy, state] : game_samples)
+        memory.append(std::move(feature), std::move(value), std::move(policy),
+                      std::move(state));
+    }
 
-        // Generate a list of indices that use random playout.
-        auto n = static_cast<int32_t>(config_.random_playout_percentage *
-                                      num_iterations);
-        auto random_playout_indices = torch::randint(num_iterations, {n});
+    metrics_.record_idle(scheduler.idle_seconds());
+  }
 
-        for (auto i : std::views::iota(0, num_iterations)) {
-          auto statistics = std::vector<std::tuple<State, torch::Tensor>>();
-          auto state = Game::initial_state();
-          while (true) {
-            auto is_not_random_playout =
-                not torch::isin(i, random_playout_indices)
-                        .template item<bool>();
-
-            // If we're performing random playout we set `num_simulations`
-            // to be random on MCTS search.
-            auto num_simulations =
-                is_not_random_playout
-                    ? config_.num_self_play_simulations
-                    : torch::randint(1, config_.num_self_play_simulations, 1)
-                          .template item<int32_t>();
-            auto action_probs =
-                mcts.search(state, model, num_simulations,
-                            is_not_random_playout ? std::make_optional(&gen_)
-                                                  : std::nullopt);
-
-            // If we're using random playout we don't include it in the
-            // dataset.
-            if (is_not_random_playout) {
-              statistics.emplace_back(state, action_probs);
-            }
+  // Plays one self-play game and stores its positions in `samples`. The game
+  // suspends whenever its search waits for `evaluator`. Every game has its
+  // own random stream, so a game is the same whichever actor plays it.
+  auto play_self_play_game(GameSamples& samples,
+                           BatchEvaluator<Model>& evaluator,
+                           Counters& counters, int32_t iteration, int32_t game,
+                           bool is_not_random_playout, int32_t bar_id)
+      -> Task<> {
+    auto mcts = MCTS<Game, Model>{
+        {.num_simulations = config_.num_self_play_simulations,
+         .mode = config_.use_gumbel_self_play ? MCTS<Game, Model>::Mode::Gumbel
+                                              : MCTS<Game, Model>::Mode::PUCT}};
+
+    auto random_num_simulations = std::uniform_int_distribution<int32_t>(
+        1, std::max(1, config_.num_self_play_simulations - 1));
+
+    auto is_bootstrap = config_.bootstrap_policy and
+                        iteration < config_.num_bootstrap_iterations;
+
+    auto gen = make_generator(config_.seed, Stream::SelfPlay, iteration, game);
+
+    auto statistics = std::vector<std::tuple<State, torch::Tensor>>();
+    auto state = Game::initial_state(gen);
+    auto record = GameRecord{.first_player = state.player};
+    while (true) {
+      auto action_probs = torch::Tensor{};
+      auto selected_action = std::optional<Action>{};
+      if (is_bootstrap) {
+        action_probs = config_.bootstrap_policy(state);
+        Counters::add(counters.moves, 1);
+      } else {
+        // If we're performing random playout we set `num_simulations` to be
+        // random on MCTS search.
+        auto num_simulations = is_not_random_playout
+                                   ? config_.num_self_play_simulations
+                                   : random_num_simulations(gen);
+        action_probs = co_await mcts.search(
+            state, evaluator, num_simulations,
+            is_not_random_playout ? std::make_optional(&gen) : std::nullopt);
+
+        record_search(counters, mcts.last_statistics());
+
+        // With noise, the Gumbel search already sampled the action to play
+        // through sequential halving.
+        if (is_not_random_playout)
+          selected_action = mcts.last_statistics().selected_action;
+      }
 
-            auto action =
-                torch::multinomial(action_probs, 1).template item<Action>();
+      // If we're using random playout we don't include it in the dataset.
+      if (is_not_random_playout) {
+        statistics.emplace_back(state, action_probs);
+      }
 
-            auto new_state = Game::apply_action(state, action);
-            if (auto outcome = Game::get_outcome(new_state, action)) {
-              for (auto& [hist_state, hist_probs] : statistics) {
-                auto hist_value = hist_state.player == state.player
-                                      ? outcome->as_tensor()
-                                      : outcome->flip().as_tensor();
-                memory.append(Game::encode_state(hist_state), hist_value,
-                              hist_probs);
-              }
-              break;
-            }
+      auto action = selected_action ? *selected_action
+                                    : sample_action(action_probs, gen);
+      if (records_) {
+        record.moves.push_back({.action = action});
+        if (is_not_random_playout)
+          record.moves.back().policy = sparse_policy(action_probs);
+      }
 
-            state = std::move(new_state);
-          }
+      auto new_state = Game::apply_action(state, action);
+      if (auto outcome = Game::get_outcome(new_state, action)) {
+        if (records_) {
+          record.outcome = state.player == record.first_player
+                               ? *outcome
+                               : outcome->flip();
+          records_->write(record);
+        }
 
-          bars_[bar_id].tick();
+        for (auto& [hist_state, hist_probs] : statistics) {
+          auto hist_value = hist_state.player == state.player
+                                ? outcome->as_tensor()
+                                : outcome->flip().as_tensor();
+          samples.emplace_back(Game::encode_state(hist_state), hist_value,
+                               hist_probs, hist_state);
+        }
+        Counters::add(counters.games, 1);
+        break;
+      }
+
+      state = std::move(new_state);
+    }
+
+    bars_[bar_id].tick();
+  }
+
+  // Searches the positions of `memory` whose policy targets come from an
+  // older best model again with `model` and replaces their targets. They are
+  // spread over the self-play actors, which keep
+  // `num_concurrent_self_play_games` searches in flight each.
+  auto reanalyse(ReplayMemory& memory, std::shared_ptr<Model> model) -> void {
+    auto span = trace::Span("reanalyse");
+
+    auto positions = memory.stale_positions(config_.num_reanalyse_positions);
+    if (positions.empty())
+      return;
+
+    model->eval();
+
+    auto placement = actor_placement(config_.num_self_play_actors);
+    auto replicas = std::optional<NodeReplicas<Model>>{};
+    if (not placement.empty())
+      replicas.emplace(model);
+
+    auto scheduler =
+        GameScheduler(positions.size(), config_.num_self_play_actors);
+
+    auto threads = std::vector<std::thread>();
+    for (auto actor : std::views::iota(0, config_.num_self_play_actors)) {
+      threads.emplace_back([this, &memory, &positions, &placement, &replicas,
+                            &scheduler, model, actor] {
+        trace::name_thread(std::format("reanalyse actor {}", actor));
+        if (replicas)
+          pin_thread(placement[actor]);
+        auto actor_model =
+            replicas ? replicas->get(placement[actor].node) : model;
+
+        auto& counters = metrics_.register_thread();
+        auto evaluator =
+            BatchEvaluator<Model>(actor_model, /*is_batched=*/true);
+        auto searches = std::vector<Task<>>{};
+
+        auto start_searches = [&] {
+          while (std::ssize(searches) <
+                 config_.num_concurrent_self_play_games) {
+            auto position = scheduler.next(actor);
+            if (not position)
+              return;
+
+            auto& [id, state] = positions[*position];
+            searches.push_back(
+                reanalyse_position(memory, evaluator, counters, id, state));
+            searches.back().resume();
+          }
+        };
+
+        torch::NoGradGuard no_grad;
+        start_searches();
+        while (not searches.empty()) {
+          if (auto batch_size = evaluator.flush(); batch_size > 0)
+            record_evaluations(counters, 1, batch_size);
+
+          std::erase_if(searches, [](Task<>& search) {
+            if (not search.is_done())
+              return false;
+            search.result();
+            return true;
+          });
+          start_searches();
         }
       });
     }
@@ -188,81 +593,197 @@ class AlphaZero {
     for (auto& thread : threads) {
       thread.join();
     }
+
+    metrics_.record_idle(scheduler.idle_seconds());
   }
 
-  auto train(Memory& memory, std::shared_ptr<Model> model,
-             std::shared_ptr<torch::optim::Optimizer> optimizer, int32_t bar_id)
-      -> float32_t {
+  auto reanalyse_position(ReplayMemory& memory,
+                          BatchEvaluator<Model>& evaluator, Counters& counters,
+                          uint64_t id, const State& state) -> Task<> {
+    auto mcts = MCTS<Game, Model>{
+        {.num_simulations = config_.num_reanalyse_simulations}};
+    auto policy = co_await mcts.search(state, evaluator);
+    Counters::add(counters.simulations,
+                  mcts.last_statistics().num_simulations);
+    memory.reanalyse(id, policy);
+  }
+
+  auto train(ReplayMemory& memory, std::shared_ptr<Model> model,
+             std::shared_ptr<torch::optim::Optimizer> optimizer,
+             Counters& counters, int32_t bar_id) -> float32_t {
+    auto span = trace::Span("train");
+
     if (memory.size() % config_.batch_size == 1)
       memory.pop();
 
     model->train();
-    memory.shuffle();
+
+    auto data_parallel = std::unique_ptr<DataParallel<Model>>{};
+    if (config_.num_training_replicas > 1)
+      data_parallel = std::make_unique<DataParallel<Model>>(
+          model, config_.num_training_replicas, config_.cores_per_replica,
+          loss);
 
     auto total_loss = 0.;
     for (auto i : std::views::iota(0, config_.num_training_epochs)) {
+      memory.shuffle();
+
       auto epoch_loss = 0.;
       for (size_t start_index = 0;
            start_index + config_.batch_size < memory.size();
            start_index += config_.batch_size) {
-        auto [feature, target_value, target_policy] =
-            memory.sample_batch(config_.batch_size, start_index);
-        auto [out_value, out_policy] = model->forward(feature);
-
-        auto loss = F::cross_entropy(out_value, target_value) +
-                    F::cross_entropy(out_policy, target_policy);
-
-        optimizer->zero_grad();
-        loss.backward();
-        optimizer->step();
+        auto step_span = trace::Span("training_step", /*sampled=*/true);
+
+        auto [feature, target_value, target_policy] = [&] {
+          auto span = trace::Span("Memory::sample_batch", /*sampled=*/true);
+          return memory.sample_batch(config_.batch_size, start_index);
+        }();
+        auto step_loss = 0.0;
+        if (data_parallel) {
+          step_loss =
+              data_parallel->backward(feature, target_value, target_policy);
+
+          auto span = trace::Span("optimizer_step", /*sampled=*/true);
+          optimizer->step();
+        } else {
+          auto batch_loss = loss(*model, feature, target_value, target_policy);
+
+          auto span = trace::Span("optimizer_step", /*sampled=*/true);
+          optimizer->zero_grad();
+          batch_loss.backward();
+          optimizer->step();
+
+          step_loss = batch_loss.template item<double>();
+        }
 
-        epoch_loss += loss.template item<double>();
+        epoch_loss += step_loss;
 
-        bars_[bar_id].set_option(opt::PostfixText{
-            std::format("Epoch {}/{}: Batch Loss: {:.6f} - Total Loss: {:.6f}",
-                        i + 1, config_.num_training_epochs,
-                        loss.template item<double>(), epoch_loss)});
+        Counters::add(counters.training_samples, feature.size(0));
         bars_[bar_id].tick();
       }
 
+      bars_[bar_id].set_option(opt::PostfixText{
+          std::format("Epoch {}/{}: Total Loss: {:.6f}", i + 1,
+                      config_.num_training_epochs, epoch_loss)});
+
       total_loss += epoch_loss;
     }
 
     return total_loss / static_cast<float32_t>(config_.num_training_epochs);
   }
 
+  static auto loss(Model& model, const torch::Tensor& feature,
+                   const torch::Tensor& target_value,
+                   const torch::Tensor& target_policy) -> torch::Tensor {
+    auto [out_value, out_policy] = model.forward(feature);
+    return F::cross_entropy(out_value, target_value) +
+           F::cross_entropy(out_policy, target_policy);
+  }
+
+  // Plays `current_model` against `best_model`, or against `baseline` when
+  // it is set.
   auto evaluate(std::shared_ptr<Model> current_model,
-                std::shared_ptr<Model> best_model, int32_t bar_id)
+                std::shared_ptr<Model> best_model, int32_t iteration,
+                int32_t bar_id, const ExternalPolicy& baseline = nullptr)
       -> std::tuple<int32_t, int32_t, int32_t> {
+    auto span = trace::Span("evaluate");
+
     current_model->eval();
     best_model->eval();
 
+    auto placement = actor_placement(config_.num_evaluation_actors);
+    auto current_replicas = std::optional<NodeReplicas<Model>>{};
+    auto best_replicas = std::optional<NodeReplicas<Model>>{};
+    if (not placement.empty()) {
+      current_replicas.emplace(current_model);
+      best_replicas.emplace(best_model);
+    }
+
     std::atomic<int32_t> wins{0};
     std::atomic<int32_t> draws{0};
     std::atomic<int32_t> losses{0};
 
+    std::atomic<int64_t> num_moves{0};
+    std::atomic<int64_t> num_simulations_saved{0};
+
+    auto scheduler = GameScheduler(
+        config_.num_evaluation_iterations * config_.num_evaluation_actors,
+        config_.num_evaluation_actors);
+
     std::vector<std::thread> threads;
 
-    for (auto _ : std::views::iota(0, config_.num_evaluation_actors)) {
-      threads.emplace_back([this, &wins, &draws, &losses, current_model,
-                            best_model, &bar_id] {
-        for (auto _ : std::views::iota(0, config_.num_evaluation_iterations)) {
-          auto state = Game::initial_state();
+    for (auto actor : std::views::iota(0, config_.num_evaluation_actors)) {
+      threads.emplace_back([this, &wins, &draws, &losses, &num_moves,
+                            &num_simulations_saved, &baseline, &placement,
+                            &current_replicas, &best_replicas, &scheduler,
+                            current_model, best_model, iteration, &bar_id,
+                            actor] {
+        trace::name_thread(std::format("evaluation actor {}", actor));
+        auto actor_current_model = current_model;
+        auto actor_best_model = best_model;
+        if (not placement.empty()) {
+          pin_thread(placement[actor]);
+          actor_current_model = current_replicas->get(placement[actor].node);
+          actor_best_model = best_replicas->get(placement[actor].node);
+        }
+
+        auto& counters = metrics_.register_thread();
+        while (auto game = scheduler.next(actor)) {
+          auto game_span = trace::Span("evaluation_game");
+          auto opponent = baseline ? Opponent::Baseline : Opponent::BestModel;
+          auto gen = make_generator(config_.seed, Stream::Evaluation, opponent,
+                                    iteration, *game);
+          auto state = Game::initial_state(gen);
+          // Recorded without policies, evaluation games are not training
+          // data.
+          auto record = GameRecord{.first_player = state.player};
+          // Moves are picked greedily so the search can stop as soon as the
+          // most visited action is settled.
           auto mcts = MCTS<Game, Model>{
-              {.num_simulations = config_.num_evaluation_simulations}};
+              {.num_simulations = config_.num_evaluation_simulations,
+               .prune_decided_root = true,
+               .opening_book = opening_book_}};
 
           while (true) {
-            auto model = state.player.is_first() ? current_model : best_model;
-            auto action_probs = mcts.search(state, model);
-
-            auto action = torch::argmax(action_probs).template item<Action>();
+            auto action = Action{};
+            if (baseline and state.player.is_second()) {
+              action = torch::argmax(baseline(state)).template item<Action>();
+            } else {
+              auto model = state.player.is_first() ? actor_current_model
+                                                   : actor_best_model;
+              auto action_probs = mcts.search(state, model);
+
+              num_moves += 1;
+              num_simulations_saved +=
+                  mcts.last_statistics().num_simulations_saved;
+              record_search(counters, mcts.last_statistics());
+              record_evaluations(counters,
+                                 mcts.last_statistics().num_evaluations,
+                                 mcts.last_statistics().num_evaluations);
+
+              // Book moves are sampled so that the games do not all follow
+              // the same opening.
+              if (mcts.last_statistics().is_book_move)
+                action = sample_action(action_probs, gen);
+              else
+                action = torch::argmax(action_probs).template item<Action>();
+            }
 
             auto new_state = Game::apply_action(state, action);
+            if (records_)
+              record.moves.push_back({.action = action});
 
             if (auto outcome = Game::get_outcome(new_state, action)) {
               auto flipped_outcome =
                   state.player.is_first() ? *outcome : outcome->flip();
 
+              if (records_) {
+                record.outcome = state.player == record.first_player
+                                     ? *outcome
+                                     : outcome->flip();
+                records_->write(record);
+              }
+
               if (flipped_outcome == GameOutcome::Win) {
                 wins += 1;
               } else if (flipped_outcome == GameOutcome::Draw) {
@@ -271,9 +792,14 @@ class AlphaZero {
                 losses += 1;
               }
 
+              Counters::add(counters.games, 1);
+
               bars_[bar_id].set_option(opt::PostfixText{std::format(
-                  "Evaluating Model: Wins: {} - Draws: {} - Losses: {}",
-                  wins.load(), draws.load(), losses.load())});
+                  "Evaluating Model: Wins: {} - Draws: {} - Losses: {} - "
+                  "Saved Simulations/Move: {:.1f}",
+                  wins.load(), draws.load(), losses.load(),
+                  static_cast<float64_t>(num_simulations_saved.load()) /
+                      static_cast<float64_t>(num_moves.load()))});
 
               bars_[bar_id].tick();
               break;
@@ -289,13 +815,53 @@ class AlphaZero {
       thread.join();
     }
 
+    metrics_.record_idle(scheduler.idle_seconds());
+
     return {wins, draws, losses};
   }
 
+  // The cores of every actor, or none when actors are not pinned. Sizes the
+  // libtorch pools to match, so call it before the actors start.
+  auto actor_placement(int32_t num_actors) const -> std::vector<CoreSet> {
+    if (not config_.pin_actors)
+      return {};
+    auto placement =
+        Topology::detect().partition(num_actors, config_.cores_per_actor);
+    size_thread_pools(placement);
+    return placement;
+  }
+
+  // Every search is followed by one move.
+  static auto record_search(
+      Counters& counters,
+      const typename MCTS<Game, Model>::Statistics& statistics) -> void {
+    Counters::add(counters.simulations, statistics.num_simulations);
+    Counters::add(counters.moves, 1);
+  }
+
+  static auto record_evaluations(Counters& counters, uint64_t num_forwards,
+                                 uint64_t num_positions) -> void {
+    Counters::add(counters.evaluations, num_forwards);
+    Counters::add(counters.evaluated_positions, num_positions);
+  }
+
+  // Registered on the first call only, `Metrics` keeps the counters of every
+  // registration for as long as it lives.
+  auto learner_counters() -> Counters& {
+    if (learner_counters_ == nullptr)
+      learner_counters_ = &metrics_.register_thread();
+    return *learner_counters_;
+  }
+
  private:
   indicators::DynamicProgress<indicators::ProgressBar> bars_;
   Config config_;
   std::mt19937 gen_;
+  Metrics metrics_;
+  // The counters of the thread that trains, see `learner_counters`.
+  Counters* learner_counters_ = nullptr;
+  std::shared_ptr<const OpeningBook<Game>> opening_book_ = nullptr;
+  std::unique_ptr<RecordWriter> records_;
 };
 
 }  // namespace az
@@ -0,0 +1,145 @@
+module;
+
+#include <torch/torch.h>
+
+export module az:book;
+
+import std;
+
+import :game;
+
+namespace az {
+
+export enum class BookMode {
+  // Answer book positions with the book's distribution without searching.
+  Play,
+  // Search book positions with the book's distribution as the root prior.
+  Prior,
+};
+
+// One action of a book position. The file is an array of entries sorted by
+// hash, then action.
+struct BookEntry {
+  uint64_t hash;
+  int16_t action;
+  // Fewest moves the position was reached in while building the book.
+  uint16_t ply;
+  float32_t weight;
+};
+static_assert(sizeof(BookEntry) == 16);
+
+// Root visit distributions of opening positions aggregated over many games,
+// keyed by `Game::hash`.
+export template <concepts::Game Game>
+class OpeningBook {
+ public:
+  // Only keeps the positions reached within `max_depth` moves.
+  static auto load(std::string_view path,
+                   int32_t max_depth = std::numeric_limits<int32_t>::max())
+      -> std::shared_ptr<const OpeningBook> {
+    auto input = std::ifstream(std::string(path), std::ios::binary);
+    if (not input)
+      throw std::runtime_error(std::format("Cannot open book {}.", path));
+
+    auto book = std::make_shared<OpeningBook>();
+    auto entry = BookEntry{};
+    while (input.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+      if (entry.ply <= max_depth)
+        book->entries_.push_back(entry);
+    }
+
+    return book;
+  }
+
+  // The distribution over the actions of `state`, or nothing if the position
+  // is not in the book.
+  auto probe(const Game::State& state) const -> std::optional<torch::Tensor> {
+    auto hash = Game::hash(state);
+    auto range = std::ranges::equal_range(entries_, hash, {}, &BookEntry::hash);
+    if (range.empty())
+      return std::nullopt;
+
+    auto policy = torch::zeros(Game::ActionSize, torch::kFloat32);
+    for (auto& entry : range)
+      policy[entry.action] = static_cast<float>(entry.weight);
+    return policy;
+  }
+
+ private:
+  std::vector<BookEntry> entries_;
+};
+
+// Collects the root visit distributions of the positions met while playing
+// games and writes them as an `OpeningBook`. Safe to share across threads.
+export template <concepts::Game Game>
+class OpeningBookBuilder {
+  struct Position {
+    uint16_t ply;
+    int32_t num_games = 0;
+    std::map<Action, double> visits;
+  };
+
+ public:
+  auto add(const Game::State& state, int32_t ply, const torch::Tensor& policy)
+      -> void {
+    auto contiguous = policy.to(torch::kFloat32).contiguous();
+    auto data = std::span(contiguous.data_ptr<float>(), contiguous.numel());
+
+    auto guard = std::lock_guard(mutex_);
+    auto first_ply = static_cast<uint16_t>(ply);
+    auto [it, _] =
+        positions_.try_emplace(Game::hash(state), Position{first_ply});
+    auto& position = it->second;
+    position.ply = std::min(position.ply, first_ply);
+    position.num_games += 1;
+    for (auto action = Action{0}; action < std::ssize(data); action++) {
+      if (data[action] > 0)
+        position.visits[action] += data[action];
+    }
+  }
+
+  // Writes the positions met in at least `min_games` games and returns how
+  // many there are.
+  auto write(std::string_view path, int32_t min_games) const -> size_t {
+    auto guard = std::lock_guard(mutex_);
+
+    auto entries = std::vector<BookEntry>{};
+    auto num_written = size_t{0};
+    for (auto& [hash, position] : positions_) {
+      if (position.num_games < min_games)
+        continue;
+
+      num_written++;
+      for (auto [action, visits] : position.visits) {
+        entries.push_back({
+            .hash = hash,
+            .action = static_cast<int16_t>(action),
+            .ply = position.ply,
+            .weight = static_cast<float32_t>(visits / position.num_games),
+        });
+      }
+    }
+
+    std::ranges::sort(entries, {}, [](const BookEntry& entry) {
+      return std::pair{entry.hash, entry.action};
+    });
+
+    auto output = std::ofstream(std::string(path), std::ios::binary);
+    if (not output)
+      throw std::runtime_error(std::format("Cannot write book {}.", path));
+    output.write(reinterpret_cast<const char*>(entries.data()),
+                 entries.size() * sizeof(BookEntry));
+    return num_written;
+  }
+
+  auto num_positions() const -> size_t {
+    auto guard = std::lock_guard(mutex_);
+    return positions_.size();
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, Position> positions_;
+};
+
+}  // namespace az
@@ -0,0 +1,168 @@
+module;
+
+#include <torch/torch.h>
+
+export module az:evaluator;
+
+import std;
+
+import :model;
+import :trace;
+
+namespace az {
+
+// Evaluates the leaves of searches with a model, or with anything else that
+// has the same forward pass. A batched evaluator suspends every coroutine that
+// awaits `evaluate` until `flush` runs one forward pass over all of them, so
+// that many searches interleaved on one thread share their forward passes.
+// Otherwise each position is evaluated on its own as soon as it is awaited.
+//
+// Only the policy over the legal actions of a position is ever needed, so it
+// is all an evaluation returns, which lets models that implement
+// `forward_legal` skip most of their policy head.
+export template <concepts::Model Model>
+class BatchEvaluator {
+ public:
+  // The value and the policy over the given actions of a single position.
+  using Output = std::tuple<torch::Tensor, torch::Tensor>;
+  // Evaluates a batch of encoded states as `Model::forward` does.
+  using Forward = std::function<Output(const torch::Tensor&)>;
+  // Evaluates a batch of encoded states and their padded legal actions as
+  // `concepts::SparsePolicyModel::forward_legal` does.
+  using LegalForward =
+      std::function<Output(const torch::Tensor&, const torch::Tensor&)>;
+
+  class Evaluation {
+   public:
+    Evaluation(BatchEvaluator& evaluator, torch::Tensor feature,
+               torch::Tensor actions)
+        : evaluator_(evaluator),
+          feature_(std::move(feature)),
+          actions_(std::move(actions)) {}
+
+    auto await_ready() -> bool { return not evaluator_.is_batched_; }
+
+    auto await_suspend(std::coroutine_handle<> handle) -> void {
+      handle_ = handle;
+      evaluator_.pending_.push_back(this);
+    }
+
+    auto await_resume() -> Output {
+      if (evaluator_.is_batched_)
+        return std::move(output_);
+
+      auto [value, policy] = evaluator_.forward(torch::unsqueeze(feature_, 0),
+                                                torch::unsqueeze(actions_, 0));
+      return {value.squeeze(0), policy.squeeze(0)};
+    }
+
+   private:
+    friend BatchEvaluator;
+
+    BatchEvaluator& evaluator_;
+    torch::Tensor feature_;
+    torch::Tensor actions_;
+    Output output_;
+    std::coroutine_handle<> handle_;
+  };
+
+  BatchEvaluator(LegalForward forward, bool is_batched)
+      : forward_(std::move(forward)), is_batched_(is_batched) {}
+
+  BatchEvaluator(Forward forward, bool is_batched)
+      : BatchEvaluator(sparsify(std::move(forward)), is_batched) {}
+
+  BatchEvaluator(std::shared_ptr<Model> model, bool is_batched)
+      : BatchEvaluator(forward_of(std::move(model)), is_batched) {}
+
+  BatchEvaluator(const BatchEvaluator&) = delete;
+  auto operator=(const BatchEvaluator&) -> BatchEvaluator& = delete;
+
+  // Goes through `forward_legal` when the model has one.
+  static auto forward_of(std::shared_ptr<Model> model) -> LegalForward {
+    if constexpr (concepts::SparsePolicyModel<Model>) {
+      return [model = std::move(model)](const torch::Tensor& features,
+                                        const torch::Tensor& actions) {
+        return model->forward_legal(features, actions);
+      };
+    } else {
+      return sparsify(
+          [model = std::move(model)](const torch::Tensor& features) {
+            return model->forward(features);
+          });
+    }
+  }
+
+  // Computes every logit with `forward` and keeps those of the actions.
+  static auto sparsify(Forward forward) -> LegalForward {
+    return [forward = std::move(forward)](
+               const torch::Tensor& features,
+               const torch::Tensor& actions) -> Output {
+      auto [value, logits] = forward(features);
+      auto indices = actions.to(logits.device());
+      auto policy = utils::legal_softmax(
+          logits.gather(1, indices.clamp_min(0)), indices);
+      return {value, policy};
+    };
+  }
+
+  // `actions` holds the indices of the legal actions of the position, the
+  // policy of the evaluation is the distribution over them in that order.
+  auto evaluate(torch::Tensor feature, torch::Tensor actions) -> Evaluation {
+    return Evaluation(*this, std::move(feature), std::move(actions));
+  }
+
+  auto num_pending() const -> size_t { return pending_.size(); }
+
+  // Evaluates every pending position in one forward pass, then resumes the
+  // coroutines that awaited them in the order they were suspended. They may
+  // queue new positions for the next flush. Returns the batch size.
+  auto flush() -> size_t {
+    auto pending = std::exchange(pending_, {});
+    if (pending.empty())
+      return 0;
+
+    {
+      auto span = trace::Span("BatchEvaluator::flush", /*sampled=*/true);
+
+      auto num_actions = int64_t{0};
+      auto features = std::vector<torch::Tensor>{};
+      features.reserve(pending.size());
+      for (auto* evaluation : pending) {
+        features.push_back(evaluation->feature_);
+        num_actions = std::max(num_actions, evaluation->actions_.size(0));
+      }
+
+      // Padded with -1 up to the most actions of any position.
+      auto actions = torch::full({std::ssize(pending), num_actions}, -1,
+                                 torch::kInt64);
+      for (auto [i, evaluation] : std::views::enumerate(pending))
+        actions[i]
+            .slice(0, 0, evaluation->actions_.size(0))
+            .copy_(evaluation->actions_);
+
+      auto [values, policies] = forward(torch::stack(features, 0), actions);
+      for (auto [i, evaluation] : std::views::enumerate(pending))
+        evaluation->output_ = {
+            values[i], policies[i].slice(0, 0, evaluation->actions_.size(0))};
+    }
+
+    for (auto* evaluation : pending)
+      evaluation->handle_.resume();
+
+    return pending.size();
+  }
+
+ private:
+  auto forward(const torch::Tensor& features, const torch::Tensor& actions)
+      -> Output {
+    torch::NoGradGuard no_grad;
+    return forward_(features, actions);
+  }
+
+  LegalForward forward_;
+  bool is_batched_;
+  std::vector<Evaluation*> pending_;
+};
+
+}  // namespace az
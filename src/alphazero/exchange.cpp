@@ -0,0 +1,55 @@
+module;
+
+#include <assert.h>
+
+export module az:exchange;
+
+import std;
+
+namespace az {
+
+// Hands the latest value of one writer thread to one reader thread without
+// either of them ever waiting for the other. The writer fills its back slot
+// and swaps it with the middle one, the reader swaps the middle slot with its
+// front one when a newer value is there. Values published faster than they
+// are read are dropped.
+export template <typename T>
+class TripleBuffer {
+ public:
+  // Only called by the writer.
+  auto publish(T value) -> void {
+    slots_[back_].value = std::move(value);
+    auto fresh = static_cast<uint8_t>(back_ | Fresh);
+    back_ = middle_.exchange(fresh, std::memory_order_acq_rel) & Index;
+  }
+
+  // Only called by the reader. Moves the latest published value to the front
+  // and returns whether there was one since the last refresh.
+  auto refresh() -> bool {
+    if (not (middle_.load(std::memory_order_relaxed) & Fresh))
+      return false;
+
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & Index;
+    return true;
+  }
+
+  // Only called by the reader, the value moved there by the last refresh.
+  auto front() const -> const T& { return slots_[front_].value; }
+
+ private:
+  static constexpr auto Index = uint8_t{0b011};
+  static constexpr auto Fresh = uint8_t{0b100};
+
+  // On their own cache lines, the writer and the reader each own one at any
+  // time.
+  struct alignas(64) Slot {
+    T value{};
+  };
+
+  std::array<Slot, 3> slots_;
+  uint8_t back_ = 0;
+  std::atomic<uint8_t> middle_ = 1;
+  uint8_t front_ = 2;
+};
+
+}  // namespace az
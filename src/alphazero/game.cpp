@@ -16,13 +16,16 @@ export class Player;
 namespace concepts {
 
 export template <typename G>
-concept Game = requires(const G::State& state, Action action) {
+concept Game = requires(const G::State& state, Action action,
+                        std::mt19937& gen) {
   { state.player } -> std::same_as<const Player&>;
 
   { G::ActionSize } -> std::same_as<const int&>;
 
   { G::initial_state() } -> std::same_as<typename G::State>;
 
+  { G::initial_state(gen) } -> std::same_as<typename G::State>;
+
   { G::apply_action(state, action) } -> std::same_as<typename G::State>;
 
   { G::get_outcome(state, action) } -> std::same_as<std::optional<GameOutcome>>;
@@ -30,6 +33,8 @@ concept Game = requires(const G::State& state, Action action) {
   { G::legal_actions(state) } -> std::same_as<torch::Tensor>;
 
   { G::encode_state(state) } -> std::same_as<torch::Tensor>;
+
+  { G::hash(state) } -> std::same_as<uint64_t>;
 };
 
 }  // namespace concepts
@@ -0,0 +1,201 @@
+module;
+
+#include <assert.h>
+
+export module az:ladder;
+
+import std;
+
+import :game;
+
+namespace az {
+
+// FNV-1a over the bytes of a file, so that checkpoints are identified by
+// their contents instead of their paths.
+export auto hash_file(std::string_view path) -> uint64_t {
+  auto input = std::ifstream(std::string(path), std::ios::binary);
+  if (not input)
+    throw std::runtime_error(std::format("Cannot open checkpoint {}.", path));
+
+  auto hash = uint64_t{0xcbf29ce484222325};
+  auto buffer = std::array<char, 1 << 16>{};
+  while (input.read(buffer.data(), buffer.size()) or input.gcount() > 0) {
+    for (auto byte : std::span(buffer.data(), input.gcount())) {
+      hash ^= static_cast<uint8_t>(byte);
+      hash *= 0x100000001b3;
+    }
+  }
+  return hash;
+}
+
+// Two checkpoints by hash and the settings their games are played with. The
+// first checkpoint plays first in even games.
+export struct Pairing {
+  uint64_t first;
+  uint64_t second;
+  uint64_t settings;
+
+  auto operator<=>(const Pairing&) const = default;
+};
+
+// The games of a pairing from the point of view of its first checkpoint.
+export struct PairingScore {
+  // A draw is half a point.
+  float64_t points = 0;
+  int32_t games = 0;
+};
+
+// Results of ladder games, appended to a text file as soon as they finish so
+// that no game is played twice, even across interrupted runs. A line is either
+//
+//   game <first> <second> <settings> <index> <outcome>
+//
+// with the hashes in hex and the outcome of the first checkpoint as 1, 0 or
+// -1, or
+//
+//   rating <checkpoint> <elo>
+//
+// where the last rating of a checkpoint is its current one. Safe to share
+// across threads.
+export class LadderCache {
+ public:
+  explicit LadderCache(std::string path) : path_(std::move(path)) {
+    auto input = std::ifstream(path_);
+    auto line = std::string{};
+    while (std::getline(input, line)) {
+      auto stream = std::istringstream(line);
+      auto kind = std::string{};
+      stream >> kind >> std::hex;
+
+      if (kind == "game") {
+        auto pairing = Pairing{};
+        auto game = int32_t{0};
+        auto outcome = int32_t{0};
+        stream >> pairing.first >> pairing.second >> pairing.settings >>
+            std::dec >> game >> outcome;
+        if (stream)
+          games_[pairing][game] = outcome;
+      } else if (kind == "rating") {
+        auto checkpoint = uint64_t{0};
+        auto elo = 0.0;
+        stream >> checkpoint >> std::dec >> elo;
+        if (stream)
+          ratings_[checkpoint] = elo;
+      }
+    }
+
+    output_.open(path_, std::ios::app);
+    if (not output_)
+      throw std::runtime_error(
+          std::format("Cannot write ladder cache {}.", path_));
+  }
+
+  auto has_played(const Pairing& pairing, int32_t game) const -> bool {
+    auto guard = std::lock_guard(mutex_);
+    auto it = games_.find(pairing);
+    return it != games_.end() and it->second.contains(game);
+  }
+
+  auto score(const Pairing& pairing) const -> PairingScore {
+    auto guard = std::lock_guard(mutex_);
+    auto score = PairingScore{};
+    if (auto it = games_.find(pairing); it != games_.end()) {
+      for (auto [_, outcome] : it->second) {
+        score.points += (outcome + 1) / 2.0;
+        score.games += 1;
+      }
+    }
+    return score;
+  }
+
+  auto record(const Pairing& pairing, int32_t game, GameOutcome outcome)
+      -> void {
+    auto value = static_cast<int32_t>(outcome.as_scalar());
+    auto guard = std::lock_guard(mutex_);
+    games_[pairing][game] = value;
+    std::println(output_, "game {:x} {:x} {:x} {} {}", pairing.first,
+                 pairing.second, pairing.settings, game, value);
+    output_.flush();
+  }
+
+  auto rating(uint64_t checkpoint) const -> std::optional<float64_t> {
+    auto guard = std::lock_guard(mutex_);
+    if (auto it = ratings_.find(checkpoint); it != ratings_.end())
+      return it->second;
+    return std::nullopt;
+  }
+
+  auto record_rating(uint64_t checkpoint, float64_t elo) -> void {
+    auto guard = std::lock_guard(mutex_);
+    ratings_[checkpoint] = elo;
+    std::println(output_, "rating {:x} {:.3f}", checkpoint,
+                 static_cast<double>(elo));
+    output_.flush();
+  }
+
+ private:
+  std::string path_;
+  mutable std::mutex mutex_;
+  std::map<Pairing, std::map<int32_t, int32_t>> games_;
+  std::map<uint64_t, float64_t> ratings_;
+  std::ofstream output_;
+};
+
+// The score of `first` against `second`, both indices of players.
+export struct MatchScore {
+  int32_t first;
+  int32_t second;
+  PairingScore score;
+};
+
+// Maximum likelihood Elo ratings under the Bradley-Terry model with draws as
+// half a win, fitted with Hunter's MM algorithm starting from `ratings`.
+// Starting from the previous fit, only the players whose games changed move,
+// so rating a new checkpoint takes few iterations. Every player also gets a
+// virtual draw against a 0 rated opponent, which keeps the ratings of players
+// that won or lost all their games finite. The first player is rated 0.
+export auto fit_elo(std::span<const MatchScore> matches,
+                    std::vector<float64_t> ratings,
+                    float64_t tolerance = 0.01, int32_t max_iterations = 10000)
+    -> std::vector<float64_t> {
+  assert(not ratings.empty());
+
+  auto strengths = std::vector<float64_t>{};
+  for (auto elo : ratings)
+    strengths.push_back(std::pow(10.0, static_cast<double>(elo) / 400.0));
+
+  auto points = std::vector<float64_t>(ratings.size(), 0.5);
+  for (auto& match : matches) {
+    points[match.first] += match.score.points;
+    points[match.second] += match.score.games - match.score.points;
+  }
+
+  for (auto _ : std::views::iota(0, max_iterations)) {
+    auto change = float64_t{0};
+    for (auto [player, strength] : std::views::enumerate(strengths)) {
+      auto denominator = 1 / (strength + 1);
+      for (auto& match : matches) {
+        if (match.first == player)
+          denominator +=
+              match.score.games / (strength + strengths[match.second]);
+        else if (match.second == player)
+          denominator +=
+              match.score.games / (strength + strengths[match.first]);
+      }
+
+      auto updated = points[player] / denominator;
+      auto ratio = static_cast<double>(updated / strength);
+      change = std::max<float64_t>(change, std::abs(400 * std::log10(ratio)));
+      strength = updated;
+    }
+
+    if (change < tolerance)
+      break;
+  }
+
+  for (auto [elo, strength] : std::views::zip(ratings, strengths))
+    elo = 400 * std::log10(static_cast<double>(strength / strengths[0]));
+  return ratings;
+}
+
+}  // namespace az
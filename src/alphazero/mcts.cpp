@@ -5,10 +5,14 @@ module;
 
 export module az:mcts;
 
+import :book;
+import :evaluator;
 import :model;
 import :node;
 import :storage;
 import :game;
+import :task;
+import :trace;
 
 import std;
 
@@ -17,6 +21,14 @@ namespace az {
 export template <concepts::Game Game, concepts::Model Model>
 class MCTS {
  public:
+  enum class Mode {
+    // AlphaZero's PUCT selection from the root with Dirichlet noise.
+    PUCT,
+    // Gumbel top-k sampling of the root actions with sequential halving,
+    // which still gives useful policy targets at a handful of simulations.
+    Gumbel,
+  };
+
   struct Config {
     int32_t num_simulations = 100;
 
@@ -26,54 +38,460 @@ class MCTS {
     float32_t dirichlet_epsilon = 0.25;
 
     float32_t temperature = 1.25;
+
+    // Stop searching once the most visited root child can no longer be
+    // overtaken and stop visiting root children that cannot catch up with it.
+    // Only valid when the move is picked greedily from the root visits.
+    bool prune_decided_root = false;
+
+    Mode mode = Mode::PUCT;
+
+    int32_t gumbel_num_considered_actions = 16;
+    float32_t gumbel_c_visit = 50.0;
+    float32_t gumbel_c_scale = 1.0;
+
+    // Positions found in the opening book skip the search or use the book as
+    // the root prior depending on `book_mode`.
+    std::shared_ptr<const OpeningBook<Game>> opening_book = nullptr;
+    BookMode book_mode = BookMode::Play;
+
+    // Keep the tree after a search. When the next search starts from the
+    // same position or one reached from it in at most two moves, it resumes
+    // from that subtree instead of an empty tree. PUCT only.
+    bool reuse_tree = false;
+  };
+
+  struct Statistics {
+    int32_t num_simulations = 0;
+    int32_t num_simulations_saved = 0;
+    int32_t num_evaluations = 0;
+
+    // The action chosen by sequential halving, only set by the Gumbel search.
+    std::optional<Action> selected_action = std::nullopt;
+
+    // Whether the policy was played straight from the opening book.
+    bool is_book_move = false;
   };
 
+  // What a running search has found so far.
+  struct Progress {
+    struct Child {
+      Action action = -1;
+      int32_t visits = 0;
+      // The mean value in [0, 1] for the player to move at the root, 0 when
+      // the child was not visited.
+      double q = 0.0;
+      double prior = 0.0;
+    };
+
+    // `Game::hash` of the root position.
+    uint64_t position = 0;
+    int32_t num_simulations = 0;
+    // By decreasing visits.
+    std::vector<Child> children;
+    // The most visited line from the root.
+    std::vector<Action> principal_variation;
+  };
+
+  using Clock = std::chrono::steady_clock;
+  using Observer = std::function<void(const Progress&)>;
+
+  // A simulation budget that only runs out at the stop condition, for timed
+  // and infinite searches. PUCT only.
+  static constexpr auto UntilStopped = std::numeric_limits<int32_t>::max();
+
   MCTS(Config config) : config_(config) {}
 
-  constexpr auto search(Game::State original_state,
-                        std::shared_ptr<Model> model,
-                        std::optional<int> num_simulations = std::nullopt,
-                        std::optional<std::mt19937*> noise_gen = std::nullopt)
+  // Ends the following searches early, with what they found so far, once
+  // `deadline` passes or a stop is requested through `stop_token`. At least
+  // one simulation always runs.
+  auto set_stop_condition(std::optional<Clock::time_point> deadline,
+                          std::stop_token stop_token = {}) -> void {
+    deadline_ = deadline;
+    stop_token_ = std::move(stop_token);
+  }
+
+  // Calls `observer` on the searching thread every `interval` simulations of
+  // the following searches and once they end. PUCT only.
+  auto set_observer(Observer observer, int32_t interval = 64) -> void {
+    observer_ = std::move(observer);
+    observer_interval_ = std::max(1, interval);
+  }
+
+  constexpr auto last_statistics() const -> const Statistics& {
+    return statistics_;
+  }
+
+  // Returns the root visit distribution for PUCT, or the improved policy built
+  // from the completed Q-values for Gumbel. In Gumbel mode `noise_gen` is the
+  // source of the Gumbel noise.
+  auto search(Game::State original_state, std::shared_ptr<Model> model,
+              std::optional<int> num_simulations = std::nullopt,
+              std::optional<std::mt19937*> noise_gen = std::nullopt)
       -> torch::Tensor {
+    return search(std::move(original_state),
+                  BatchEvaluator<Model>::forward_of(std::move(model)),
+                  num_simulations, noise_gen);
+  }
+
+  // Same as above with the leaves evaluated by `forward` instead of a model.
+  auto search(Game::State original_state,
+              typename BatchEvaluator<Model>::LegalForward forward,
+              std::optional<int> num_simulations = std::nullopt,
+              std::optional<std::mt19937*> noise_gen = std::nullopt)
+      -> torch::Tensor {
+    auto span = trace::Span("MCTS::search", /*sampled=*/true);
     torch::NoGradGuard no_grad;
 
-    auto root_id = nodes_.create(original_state.player);
-    if (noise_gen) {
-      expand(root_id, original_state, model);
-      add_exploration_noise(root_id, *noise_gen);
-    }
+    auto evaluator = BatchEvaluator<Model>(std::move(forward),
+                                           /*is_batched=*/false);
+    auto task = search(std::move(original_state), evaluator, num_simulations,
+                       noise_gen);
+    task.resume();
+    return task.result();
+  }
 
+  // Same as above with the leaves evaluated by `evaluator`. With a batched
+  // evaluator the search suspends at every leaf until the evaluator is
+  // flushed, which lets one thread interleave many searches.
+  auto search(Game::State original_state, BatchEvaluator<Model>& evaluator,
+              std::optional<int> num_simulations = std::nullopt,
+              std::optional<std::mt19937*> noise_gen = std::nullopt)
+      -> Task<torch::Tensor> {
     num_simulations = num_simulations.value_or(config_.num_simulations);
-    for (auto _ : std::views::iota(0, *num_simulations + 1)) {
-      auto node = nodes_.as_ref(root_id);
-      auto state = original_state;
+    num_evaluations_ = 0;
+    assert(*num_simulations != UntilStopped or
+           (config_.mode == Mode::PUCT and
+            (deadline_ or stop_token_.stop_possible())));
+
+    auto book_policy = std::optional<torch::Tensor>{};
+    if (config_.opening_book)
+      book_policy = config_.opening_book->probe(original_state);
+
+    if (book_policy and config_.book_mode == BookMode::Play) {
+      statistics_ = {.num_simulations = 0,
+                     .num_simulations_saved = *num_simulations == UntilStopped
+                                                  ? 0
+                                                  : *num_simulations,
+                     .is_book_move = true};
+      co_return *book_policy / book_policy->sum(0);
+    }
 
-      while (node->is_expanded()) {
-        node = highest_child_score(node.id);
-        state = Game::apply_action(state, node->action);
-      }
+    auto is_reused = config_.reuse_tree and config_.mode == Mode::PUCT and
+                     reuse_root(original_state);
+    if (not is_reused)
+      nodes_.clear();
 
-      if (auto outcome = Game::get_outcome(state, node->action)) {
-        auto& parent = nodes_.get(node->parent_id);
-        backpropagate(node.id, outcome->as_scalar(), parent.player);
-      } else {
-        auto value = expand(node.id, state, model);
-        backpropagate(node.id, value, state.player);
-      }
+    auto policy = config_.mode == Mode::Gumbel
+                      ? co_await gumbel_search(original_state, evaluator,
+                                               *num_simulations, noise_gen,
+                                               book_policy)
+                      : co_await puct_search(original_state, evaluator,
+                                             *num_simulations, noise_gen,
+                                             book_policy);
+
+    if (config_.reuse_tree)
+      root_state_ = original_state;
+    else
+      nodes_.clear();
+
+    statistics_.num_evaluations = num_evaluations_;
+
+    co_return policy;
+  }
+
+ private:
+  auto puct_search(const Game::State& original_state,
+                   BatchEvaluator<Model>& evaluator, int32_t num_simulations,
+                   std::optional<std::mt19937*> noise_gen,
+                   std::optional<torch::Tensor> root_prior)
+      -> Task<torch::Tensor> {
+    // A reused root is always the first node.
+    auto root_id = nodes_.is_empty() ? nodes_.create(original_state.player)
+                                     : NodeId(0);
+    if ((noise_gen or root_prior) and not nodes_.get(root_id).is_expanded())
+      co_await expand(root_id, original_state, evaluator);
+    // A reused root still has the noise of the search that made it the root.
+    if (nodes_.get(root_id).is_expanded())
+      remove_exploration_noise(root_id);
+    if (root_prior)
+      set_priors(root_id, *root_prior);
+    if (noise_gen)
+      add_exploration_noise(root_id, *noise_gen);
+
+    auto is_until_stopped = num_simulations == UntilStopped;
+    auto budget = is_until_stopped ? UntilStopped : num_simulations + 1;
+    auto simulation = 0;
+    for (; simulation < budget; simulation++) {
+      if (simulation > 0 and should_stop())
+        break;
+
+      auto remaining = budget - simulation;
+      if (config_.prune_decided_root and is_root_decided(root_id, remaining))
+        break;
+
+      auto root_child = std::optional<NodeId>();
+      if (config_.prune_decided_root and nodes_.get(root_id).is_expanded())
+        root_child = highest_viable_child_score(root_id, remaining);
+
+      co_await simulate(root_id, original_state, evaluator, root_child);
+
+      if (observer_ and (simulation + 1) % observer_interval_ == 0)
+        observer_(progress(root_id, original_state, simulation + 1));
     }
 
+    if (observer_)
+      observer_(progress(root_id, original_state, simulation));
+
     auto child_visits = torch::zeros(Game::ActionSize, torch::kFloat32);
     for (auto child_id : nodes_.get(root_id).children()) {
       auto& child = nodes_.get(child_id);
       child_visits[child.action] = auto(child.visits);
     }
 
-    nodes_.clear();
+    statistics_ = {.num_simulations = simulation,
+                   .num_simulations_saved =
+                       is_until_stopped ? 0 : budget - simulation};
 
-    return child_visits / child_visits.sum(0);
+    co_return child_visits / child_visits.sum(0);
+  }
+
+  // Gumbel root search (Danihelka et al., 2022). Below the root the tree is
+  // still explored with PUCT.
+  auto gumbel_search(const Game::State& original_state,
+                     BatchEvaluator<Model>& evaluator, int32_t num_simulations,
+                     std::optional<std::mt19937*> gen,
+                     std::optional<torch::Tensor> root_prior)
+      -> Task<torch::Tensor> {
+    auto root_id = nodes_.create(original_state.player);
+    auto root_value = co_await expand(root_id, original_state, evaluator);
+    backpropagate(root_id, root_value, original_state.player);
+    if (root_prior)
+      set_priors(root_id, *root_prior);
+
+    auto children =
+        std::ranges::to<std::vector<NodeId>>(nodes_.get(root_id).children());
+    auto num_children = static_cast<int32_t>(children.size());
+
+    auto logits = std::vector<double>(num_children);
+    auto gumbels = std::vector<double>(num_children, 0.0);
+    auto extreme_value = std::extreme_value_distribution<double>(0.0, 1.0);
+    for (auto i : std::views::iota(0, num_children)) {
+      logits[i] = std::log(std::max(nodes_.get(children[i]).prior, 1e-12));
+      if (gen)
+        gumbels[i] = extreme_value(**gen);
+    }
+
+    auto sigma = [this, &children](double q) {
+      auto max_visits = 0.0;
+      for (auto child_id : children)
+        max_visits = std::max(max_visits, nodes_.get(child_id).visits);
+      return (config_.gumbel_c_visit + max_visits) * config_.gumbel_c_scale *
+             q;
+    };
+
+    // Unvisited children are completed with a mix of the root value and the
+    // prior weighted Q-values of the visited ones.
+    auto completed_q = [this, &children, root_value] {
+      auto sum_visits = 0.0;
+      auto sum_priors = 0.0;
+      auto weighted_q = 0.0;
+      for (auto child_id : children) {
+        auto& child = nodes_.get(child_id);
+        if (child.visits == 0)
+          continue;
+        sum_visits += child.visits;
+        sum_priors += child.prior;
+        weighted_q += child.prior * mean_value(child_id);
+      }
+
+      auto mixed_value = (root_value + 1) / 2.0;
+      if (sum_visits > 0 and sum_priors > 0)
+        mixed_value = (mixed_value + sum_visits * weighted_q / sum_priors) /
+                      (1 + sum_visits);
+
+      auto q = std::vector<double>(children.size());
+      for (auto [child_id, value] : std::views::zip(children, q))
+        value = nodes_.get(child_id).visits == 0 ? mixed_value
+                                                 : mean_value(child_id);
+      return q;
+    };
+
+    auto considered = std::ranges::to<std::vector<int32_t>>(
+        std::views::iota(0, num_children));
+
+    // Sample the top-k actions without replacement through the Gumbel-max
+    // trick, no Q-values are known yet.
+    auto num_considered =
+        std::min({config_.gumbel_num_considered_actions, num_children,
+                  std::max(num_simulations, 1)});
+    std::ranges::sort(considered, std::greater{},
+                      [&](int32_t i) { return gumbels[i] + logits[i]; });
+    considered.resize(num_considered);
+
+    auto num_phases = std::max(
+        1, static_cast<int32_t>(std::ceil(std::log2(num_considered))));
+
+    auto simulation = 0;
+    for (auto phase = 0; phase < num_phases; phase++) {
+      auto phase_budget = (num_simulations - simulation) / (num_phases - phase);
+      auto visits_per_action = std::max(
+          1, phase_budget / static_cast<int32_t>(considered.size()));
+
+      for (auto _ : std::views::iota(0, visits_per_action)) {
+        for (auto i : considered) {
+          if (simulation == num_simulations or
+              (simulation > 0 and should_stop()))
+            break;
+          co_await simulate(root_id, original_state, evaluator, children[i]);
+          simulation++;
+        }
+      }
+
+      auto q = completed_q();
+      std::ranges::sort(considered, std::greater{}, [&](int32_t i) {
+        return gumbels[i] + logits[i] + sigma(q[i]);
+      });
+      considered.resize((considered.size() + 1) / 2);
+    }
+
+    auto q = completed_q();
+    auto improved_logits = std::vector<double>(num_children);
+    for (auto i : std::views::iota(0, num_children))
+      improved_logits[i] = logits[i] + sigma(q[i]);
+
+    auto max_logit = std::ranges::max(improved_logits);
+    auto policy = torch::zeros(Game::ActionSize, torch::kFloat32);
+    for (auto i : std::views::iota(0, num_children)) {
+      auto action = nodes_.get(children[i]).action;
+      policy[action] = std::exp(improved_logits[i] - max_logit);
+    }
+
+    auto selected_action = nodes_.get(children[considered.front()]).action;
+    statistics_ = {.num_simulations = simulation,
+                   .num_simulations_saved = 0,
+                   .selected_action = selected_action};
+
+    co_return policy / policy.sum(0);
+  }
+
+  auto progress(NodeId root_id, const Game::State& state,
+                int32_t num_simulations) const -> Progress {
+    auto progress = Progress{.position = Game::hash(state),
+                             .num_simulations = num_simulations};
+    auto& root = nodes_.get(root_id);
+    if (not root.is_expanded())
+      return progress;
+
+    for (auto child_id : root.children()) {
+      auto& child = nodes_.get(child_id);
+      progress.children.push_back(
+          {.action = child.action,
+           .visits = static_cast<int32_t>(child.visits),
+           .q = child.visits > 0 ? mean_value(child_id) : 0.0,
+           .prior = child.prior});
+    }
+    std::ranges::sort(progress.children, std::greater{},
+                      &Progress::Child::visits);
+
+    for (auto node_id = root_id; nodes_.get(node_id).is_expanded();) {
+      node_id = highest_child_visits(node_id);
+      if (nodes_.get(node_id).visits == 0)
+        break;
+      progress.principal_variation.push_back(nodes_.get(node_id).action);
+    }
+
+    return progress;
+  }
+
+  auto should_stop() const -> bool {
+    return stop_token_.stop_requested() or
+           (deadline_ and Clock::now() >= *deadline_);
+  }
+
+  // Makes the node of `state` the root of the kept tree when `state` is the
+  // last root or is reached from it in at most two moves, dropping the rest
+  // of the tree. Returns whether there was such a node.
+  auto reuse_root(const Game::State& state) -> bool {
+    if (not root_state_ or nodes_.is_empty())
+      return false;
+
+    auto hash = Game::hash(state);
+    if (Game::hash(*root_state_) == hash)
+      return true;
+
+    auto& root = nodes_.get(NodeId(0));
+    if (not root.is_expanded())
+      return false;
+
+    for (auto child_id : root.children()) {
+      auto& child = nodes_.get(child_id);
+      auto child_state = Game::apply_action(*root_state_, child.action);
+      if (Game::hash(child_state) == hash) {
+        nodes_ = nodes_.subtree(child_id);
+        return true;
+      }
+
+      if (not child.is_expanded())
+        continue;
+
+      for (auto grandchild_id : child.children()) {
+        auto action = nodes_.get(grandchild_id).action;
+        if (Game::hash(Game::apply_action(child_state, action)) == hash) {
+          nodes_ = nodes_.subtree(grandchild_id);
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  // Runs a single simulation from the root. The first step can be forced to
+  // `root_child`, every other step follows the highest PUCT score.
+  auto simulate(NodeId root_id, const Game::State& original_state,
+                BatchEvaluator<Model>& evaluator,
+                std::optional<NodeId> root_child = std::nullopt) -> Task<> {
+    auto node = nodes_.as_ref(root_id);
+    auto state = original_state;
+
+    if (root_child) {
+      node = *root_child;
+      state = Game::apply_action(state, node->action);
+    }
+
+    while (node->is_expanded()) {
+      node = highest_child_score(node.id);
+      state = Game::apply_action(state, node->action);
+    }
+
+    // The root is expanded even when its outcome is already decided, e.g. by
+    // a tablebase: the search still has to rank its moves, and it has no
+    // parent to score the outcome for.
+    auto outcome = node.id == root_id
+                       ? std::nullopt
+                       : Game::get_outcome(state, node->action);
+    if (outcome) {
+      auto& parent = nodes_.get(node->parent_id);
+      backpropagate(node.id, outcome->as_scalar(), parent.player);
+    } else {
+      auto value = co_await expand(node.id, state, evaluator);
+      backpropagate(node.id, value, state.player);
+    }
+  }
+
+  // Mean value of a visited child from its parent's point of view in [0, 1].
+  constexpr auto mean_value(NodeId id) const -> double {
+    auto& child = nodes_.get(id);
+    auto& parent = nodes_.get(child.parent_id);
+
+    auto mean = ((child.value / child.visits) + 1) / 2.0;
+    if (child.player != parent.player)
+      mean = 1 - mean;
+
+    return mean;
   }
 
- private:
   constexpr auto score(NodeId id) const -> double {
     auto& child = nodes_.get(id);
     auto& parent = nodes_.get(child.parent_id);
@@ -84,11 +502,7 @@ class MCTS {
     if (child.visits == 0)
       return exploration;
 
-    auto mean = ((child.value / child.visits) + 1) / 2.0;
-    if (child.player != parent.player)
-      mean = 1 - mean;
-
-    return mean + exploration;
+    return mean_value(id) + exploration;
   };
 
   constexpr auto highest_child_score(NodeId id) const -> NodeId {
@@ -115,32 +529,74 @@ class MCTS {
     return *std::ranges::max_element(range, highest_visits);
   };
 
-  constexpr auto expand(NodeId parent_id, const Game::State& state,
-                        std::shared_ptr<Model> model) -> double {
-    torch::NoGradGuard no_grad;
+  // The root decision is settled when the runner-up could not overtake the
+  // leader even if it received every remaining simulation.
+  constexpr auto is_root_decided(NodeId root_id, int32_t remaining) const
+      -> bool {
+    auto& root = nodes_.get(root_id);
+    if (not root.is_expanded())
+      return false;
+
+    auto leader_id = highest_child_visits(root_id);
+    auto& leader = nodes_.get(leader_id);
+    if (root.num_children() == 1)
+      return leader.visits > 0;
+
+    auto runner_up_visits = 0.0;
+    for (auto child_id : root.children()) {
+      if (child_id == leader_id)
+        continue;
+      runner_up_visits =
+          std::max(runner_up_visits, nodes_.get(child_id).visits);
+    }
+
+    return leader.visits - runner_up_visits > remaining;
+  }
+
+  // Like `highest_child_score` but ignores the root children that can no
+  // longer reach the leader's visit count with the remaining simulations.
+  constexpr auto highest_viable_child_score(NodeId root_id,
+                                            int32_t remaining) const
+      -> NodeId {
+    auto leader_visits = nodes_.get(highest_child_visits(root_id)).visits;
+
+    auto is_viable = [this, leader_visits, remaining](NodeId id) {
+      return nodes_.get(id).visits + remaining >= leader_visits;
+    };
+
+    auto highest_score = [this](NodeId a, NodeId b) {
+      return score(a) < score(b);
+    };
 
-    auto feature = Game::encode_state(state);
-    auto legal_actions = Game::legal_actions(state);
+    auto range = nodes_.get(root_id).children() | std::views::filter(is_viable);
+    return *std::ranges::max_element(range, highest_score);
+  }
+
+  auto expand(NodeId parent_id, const Game::State& state,
+              BatchEvaluator<Model>& evaluator) -> Task<double> {
+    num_evaluations_ += 1;
 
-    auto [wdl, policy] = model->forward(torch::unsqueeze(feature, 0));
-    policy = torch::softmax(torch::squeeze(policy, 0), -1);
-    policy *= legal_actions;
-    policy /= policy.sum();
+    auto actions = Game::legal_actions(state).nonzero().flatten();
+    auto [wdl, policy] =
+        co_await evaluator.evaluate(Game::encode_state(state), actions);
+
+    // Spans cannot stay open across the suspension above, other searches of
+    // the thread run in the meantime.
+    auto span = trace::Span("MCTS::expand", /*sampled=*/true);
+    torch::NoGradGuard no_grad;
 
     auto parent = nodes_.as_ref(parent_id);
 
-    auto actions = legal_actions.nonzero();
+    // The policy is already normalized over the legal actions.
     for (auto i = 0; i < actions.size(0); i++) {
       auto action = actions[i].template item<Action>();
-      auto prior = policy[action].template item<double>();
+      auto prior = policy[i].template item<double>();
       auto new_state = Game::apply_action(state, action);
       parent.create_child(new_state.player, action, prior);
     }
 
-    wdl = wdl.squeeze(0);
-
     auto value = wdl[0] - wdl[2];
-    return value.template item<double>();
+    co_return value.template item<double>();
   };
 
   constexpr auto backpropagate(NodeId node_id, double value, Player player)
@@ -160,6 +616,23 @@ class MCTS {
     };
   };
 
+  // Replaces the priors of the children of `node_id` with `policy`.
+  auto set_priors(NodeId node_id, const torch::Tensor& policy) -> void {
+    auto normalized = (policy / policy.sum(0)).contiguous();
+    for (auto child_id : nodes_.get(node_id).children()) {
+      auto& child = nodes_.get(child_id);
+      child.prior = normalized[child.action].template item<double>();
+      child.clean_prior = child.prior;
+    }
+  }
+
+  constexpr auto remove_exploration_noise(NodeId node_id) -> void {
+    for (auto child_id : nodes_.get(node_id).children()) {
+      auto& child = nodes_.get(child_id);
+      child.prior = child.clean_prior;
+    }
+  }
+
   constexpr auto add_exploration_noise(NodeId node_id, std::mt19937* gen)
       -> void {
     assert(gen != nullptr);
@@ -181,13 +654,24 @@ class MCTS {
     for (auto [child_id, x] : std::views::zip(node.children(), noise)) {
       auto& child = nodes_.get(child_id);
       x = x / sum;
-      child.prior = child.prior * (1 - epsilon) + x * epsilon;
+      child.prior = child.clean_prior * (1 - epsilon) + x * epsilon;
     }
   }
 
  private:
   NodeStorage nodes_;
   Config config_;
+  Statistics statistics_;
+  int32_t num_evaluations_ = 0;
+
+  // The position of the root of `nodes_` when the tree is kept.
+  std::optional<typename Game::State> root_state_;
+
+  std::optional<Clock::time_point> deadline_;
+  std::stop_token stop_token_;
+
+  Observer observer_;
+  int32_t observer_interval_ = 64;
 };
 
 }  // namespace az
@@ -14,36 +14,173 @@ export using Feature = torch::Tensor;
 export using Policy = torch::Tensor;
 export using Value = torch::Tensor;
 
-export class Memory {
+// Limits of the positions kept across iterations. The oldest iterations are
+// evicted first.
+export struct ReplayWindow {
+  int32_t max_iterations = 1;
+  size_t max_positions = std::numeric_limits<size_t>::max();
+
+  // Every epoch samples positions with a weight of `age_decay` to the power
+  // of their age in iterations. At 1 an epoch is a plain shuffle of the
+  // window.
+  float32_t age_decay = 1.0;
+
+  // The share of positions with reanalysed policy targets in every stretch of
+  // an epoch, and so in every batch. The rest have their self-play targets.
+  // When unset both kinds are mixed in proportion to their number.
+  std::optional<float32_t> reanalysed_fraction = std::nullopt;
+};
+
+// The training positions. Each also keeps its `Position`, the game state it
+// was encoded from, so that its policy target can be searched again with a
+// newer model.
+export template <typename Position = std::monostate>
+class Memory {
+  struct Sample {
+    Feature feature;
+    Value value;
+    Policy policy;
+    int32_t iteration;
+    Position position;
+    // Increases by one with every appended position.
+    uint64_t id;
+    // The version of the best model that searched `policy`, see
+    // `begin_iteration`.
+    int32_t model_version;
+    bool is_reanalysed = false;
+  };
+
  public:
-  Memory(std::mt19937& gen) : gen_(gen) {}
+  Memory(std::mt19937& gen, ReplayWindow window = {})
+      : gen_(gen), window_(window) {}
 
   constexpr auto size() -> size_t { return data_.size(); }
 
+  // Stamps the positions appended from now on with `iteration` and evicts
+  // the ones that fell out of the window. `model_version` counts the best
+  // models promoted so far, the policies searched from now on are stamped
+  // with it.
+  auto begin_iteration(int32_t iteration, int32_t model_version = 0) -> void {
+    auto guard = std::lock_guard(mutex_);
+    iteration_ = iteration;
+    model_version_ = model_version;
+
+    while (not data_.empty() and
+           data_.front().iteration <= iteration - window_.max_iterations)
+      data_.pop_front();
+
+    order_.clear();
+  }
+
   constexpr auto pop() -> void {
     auto guard = std::lock_guard(mutex_);
     data_.pop_back();
+    order_.clear();
   }
 
-  constexpr auto shuffle() -> void {
+  // Orders the window for the next epoch, see `ReplayWindow::age_decay` and
+  // `ReplayWindow::reanalysed_fraction`.
+  auto shuffle() -> void {
     auto guard = std::lock_guard(mutex_);
-    std::ranges::shuffle(data_, gen_);
+
+    if (not window_.reanalysed_fraction) {
+      auto all = std::ranges::to<std::vector<size_t>>(
+          std::views::iota(size_t{0}, data_.size()));
+      order_ = epoch_order(all, data_.size());
+      return;
+    }
+
+    auto reanalysed = std::vector<size_t>{};
+    auto fresh = std::vector<size_t>{};
+    for (auto [i, sample] : std::views::enumerate(data_))
+      (sample.is_reanalysed ? reanalysed : fresh).push_back(i);
+
+    // The positions of a kind are drawn again once there are not enough of
+    // them for their share of the epoch.
+    auto fraction = std::clamp(*window_.reanalysed_fraction, 0.0f, 1.0f);
+    if (reanalysed.empty())
+      fraction = 0;
+    if (fresh.empty())
+      fraction = 1;
+
+    // Exactly the number of reanalysed steps below.
+    auto num_reanalysed =
+        static_cast<size_t>(std::floor(data_.size() * fraction));
+    auto reanalysed_order = epoch_order(reanalysed, num_reanalysed);
+    auto fresh_order = epoch_order(fresh, data_.size() - num_reanalysed);
+
+    // Spread evenly, every stretch of the epoch has the same share of
+    // reanalysed positions up to one.
+    order_.clear();
+    auto next_reanalysed = reanalysed_order.begin();
+    auto next_fresh = fresh_order.begin();
+    for (auto i : std::views::iota(size_t{0}, data_.size())) {
+      auto is_reanalysed =
+          std::floor((i + 1) * fraction) > std::floor(i * fraction);
+      order_.push_back(is_reanalysed ? *next_reanalysed++ : *next_fresh++);
+    }
   }
 
-  auto append(Feature feature, Value value, Policy policy) -> void {
+  auto append(Feature feature, Value value, Policy policy,
+              Position position = {}) -> void {
     auto guard = std::lock_guard(mutex_);
 
-    data_.emplace_back(feature, value, policy);
+    data_.push_back({.feature = std::move(feature),
+                     .value = std::move(value),
+                     .policy = std::move(policy),
+                     .iteration = iteration_,
+                     .position = std::move(position),
+                     .id = next_id_++,
+                     .model_version = model_version_});
+    if (data_.size() > window_.max_positions)
+      data_.pop_front();
+
+    order_.clear();
   }
 
+  // Up to `count` random positions whose policy target was searched by an
+  // older best model than the current one, with the ids to update them.
+  // Positions searched by the current best model are never stale, however
+  // old their iteration.
+  auto stale_positions(size_t count)
+      -> std::vector<std::pair<uint64_t, Position>> {
+    auto guard = std::lock_guard(mutex_);
+
+    auto stale = std::vector<const Sample*>{};
+    for (auto& sample : data_)
+      if (sample.model_version < model_version_)
+        stale.push_back(&sample);
+
+    auto chosen = std::vector<const Sample*>{};
+    std::ranges::sample(stale, std::back_inserter(chosen), count, gen_);
+
+    auto positions = std::vector<std::pair<uint64_t, Position>>{};
+    for (auto* sample : chosen)
+      positions.emplace_back(sample->id, sample->position);
+    return positions;
+  }
+
+  // Replaces the policy target of the position `id`, if it is still in the
+  // window. Ids are increasing but not contiguous, since `pop` drops ids.
+  auto reanalyse(uint64_t id, Policy policy) -> void {
+    auto guard = std::lock_guard(mutex_);
+    auto sample = std::ranges::lower_bound(data_, id, {}, &Sample::id);
+    if (sample == data_.end() or sample->id != id)
+      return;
+
+    sample->policy = std::move(policy);
+    sample->model_version = model_version_;
+    sample->is_reanalysed = true;
+  }
+
+  // Takes the batch at `start` in the order of the last `shuffle`, or in the
+  // order of insertion before any.
   auto sample_batch(std::size_t batch_size, std::size_t start)
       -> std::tuple<Feature, Value, Policy> {
     auto guard = std::lock_guard(mutex_);
 
     auto size = std::min(batch_size, data_.size() - start);
 
-    auto batch = std::span{data_.begin() + start, data_.begin() + start + size};
-
     // // TODO: investigate why this invariant is invalidated sometimes which
     // causes the batch norm to throw an exception.
     // assert(size > 1);
@@ -56,10 +193,11 @@ export class Memory {
     values.reserve(size);
     policies.reserve(size);
 
-    for (auto [feature, value, policy] : batch) {
-      features.emplace_back(feature);
-      values.emplace_back(value);
-      policies.emplace_back(policy);
+    for (auto i : std::views::iota(start, start + size)) {
+      auto& sample = data_[order_.empty() ? i : order_[i]];
+      features.emplace_back(sample.feature);
+      values.emplace_back(sample.value);
+      policies.emplace_back(sample.policy);
     }
 
     return {torch::stack(features, 0), torch::stack(values, 0),
@@ -67,9 +205,50 @@ export class Memory {
   }
 
  private:
+  // `size` draws from `indices`, a shuffle that repeats when `size` is larger,
+  // or samples weighted by `age_decay`.
+  auto epoch_order(std::span<const size_t> indices, size_t size)
+      -> std::vector<size_t> {
+    auto order = std::vector<size_t>{};
+    if (indices.empty() or size == 0)
+      return order;
+
+    order.reserve(size);
+    if (window_.age_decay == 1.0) {
+      auto shuffled = std::ranges::to<std::vector<size_t>>(indices);
+      while (order.size() < size) {
+        std::ranges::shuffle(shuffled, gen_);
+        auto count = std::min(shuffled.size(), size - order.size());
+        order.insert(order.end(), shuffled.begin(), shuffled.begin() + count);
+      }
+      return order;
+    }
+
+    auto weights = std::vector<double>{};
+    weights.reserve(indices.size());
+    for (auto i : indices) {
+      auto age = iteration_ - data_[i].iteration;
+      weights.push_back(std::pow(static_cast<double>(window_.age_decay), age));
+    }
+
+    auto distribution =
+        std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    for (auto _ : std::views::iota(size_t{0}, size))
+      order.push_back(indices[distribution(gen_)]);
+    return order;
+  }
+
   std::mutex mutex_;
   std::mt19937& gen_;
-  std::vector<std::tuple<Feature, Value, Policy>> data_;
+  ReplayWindow window_;
+
+  int32_t iteration_ = 0;
+  int32_t model_version_ = 0;
+  uint64_t next_id_ = 0;
+  // Positions in order of insertion, the oldest first.
+  std::deque<Sample> data_;
+  // Indices into `data_` for the current epoch.
+  std::vector<size_t> order_;
 };
 
 }  // namespace az
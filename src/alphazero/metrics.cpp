@@ -0,0 +1,190 @@
+module;
+
+#include <assert.h>
+
+export module az:metrics;
+
+import std;
+
+namespace az {
+
+// Counters written by a single thread. Since there is only one writer an
+// increment is a relaxed load and store, which never takes a lock nor a locked
+// instruction, while the reporter thread can still read them at any time.
+export struct alignas(64) Counters {
+  std::atomic<uint64_t> simulations{0};
+  // Number of forward passes and the number of positions across them.
+  std::atomic<uint64_t> evaluations{0};
+  std::atomic<uint64_t> evaluated_positions{0};
+  std::atomic<uint64_t> moves{0};
+  std::atomic<uint64_t> games{0};
+  std::atomic<uint64_t> training_samples{0};
+
+  static auto add(std::atomic<uint64_t>& counter, uint64_t n) -> void {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+};
+
+// Aggregates the counters of every thread and periodically writes their rates
+// as JSON lines, together with the time spent in each phase of an iteration.
+export class Metrics {
+  struct Totals {
+    uint64_t simulations = 0;
+    uint64_t evaluations = 0;
+    uint64_t evaluated_positions = 0;
+    uint64_t moves = 0;
+    uint64_t games = 0;
+    uint64_t training_samples = 0;
+
+    constexpr auto operator-(const Totals& other) const -> Totals {
+      return {
+          .simulations = simulations - other.simulations,
+          .evaluations = evaluations - other.evaluations,
+          .evaluated_positions =
+              evaluated_positions - other.evaluated_positions,
+          .moves = moves - other.moves,
+          .games = games - other.games,
+          .training_samples = training_samples - other.training_samples,
+      };
+    }
+  };
+
+  using Clock = std::chrono::steady_clock;
+  using Seconds = std::chrono::duration<double>;
+
+ public:
+  // Without a path the counters are still kept but nothing is written.
+  Metrics(std::optional<std::string> path, std::chrono::milliseconds interval)
+      : interval_(interval) {
+    if (not path)
+      return;
+
+    output_.open(*path, std::ios::app);
+    reporter_ = std::jthread([this](std::stop_token stop_token) {
+      auto lock = std::unique_lock(mutex_);
+      while (true) {
+        wake_up_.wait_for(lock, stop_token, interval_, [] { return false; });
+        if (stop_token.stop_requested())
+          break;
+
+        if (phase_)
+          write_record("rates", last_report_totals_, last_report_time_);
+      }
+    });
+  }
+
+  // Returns counters owned by the caller. Call it once per thread and keep the
+  // reference, the counters live as long as `Metrics`.
+  auto register_thread() -> Counters& {
+    auto guard = std::lock_guard(mutex_);
+    return slots_.emplace_back();
+  }
+
+  auto begin_phase(int32_t iteration, std::string_view phase) -> void {
+    auto guard = std::lock_guard(mutex_);
+    iteration_ = iteration;
+    phase_ = std::string(phase);
+    phase_start_time_ = last_report_time_ = Clock::now();
+    phase_start_totals_ = last_report_totals_ = totals();
+    idle_seconds_.clear();
+  }
+
+  // Seconds each thread of the phase spent waiting for the others, written
+  // with the phase's record.
+  auto record_idle(std::vector<double> seconds) -> void {
+    auto guard = std::lock_guard(mutex_);
+    idle_seconds_ = std::move(seconds);
+  }
+
+  auto end_phase() -> void {
+    auto guard = std::lock_guard(mutex_);
+    assert(phase_.has_value());
+    write_record("phase", phase_start_totals_, phase_start_time_);
+    phase_ = std::nullopt;
+  }
+
+ private:
+  auto totals() const -> Totals {
+    auto sum = Totals{};
+    for (auto& slot : slots_) {
+      sum.simulations += slot.simulations.load(std::memory_order_relaxed);
+      sum.evaluations += slot.evaluations.load(std::memory_order_relaxed);
+      sum.evaluated_positions +=
+          slot.evaluated_positions.load(std::memory_order_relaxed);
+      sum.moves += slot.moves.load(std::memory_order_relaxed);
+      sum.games += slot.games.load(std::memory_order_relaxed);
+      sum.training_samples +=
+          slot.training_samples.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  // Writes the rates since `since_time`, must be called with `mutex_` held.
+  auto write_record(std::string_view type, Totals since_totals,
+                    Clock::time_point since_time) -> void {
+    if (not output_.is_open())
+      return;
+
+    auto now = Clock::now();
+    auto current = totals();
+    auto delta = current - since_totals;
+    auto seconds = std::max(Seconds(now - since_time).count(), 1e-9);
+
+    auto ratio = [](uint64_t a, uint64_t b) {
+      return b == 0 ? 0.0 : static_cast<double>(a) / static_cast<double>(b);
+    };
+
+    auto idle = std::string{};
+    if (type == "phase" and not idle_seconds_.empty()) {
+      auto values = idle_seconds_ | std::views::transform([](double value) {
+                      return std::format("{:.3f}", value);
+                    }) |
+                    std::views::join_with(std::string_view(", "));
+      idle = std::format(R"(, "idle_seconds": [{}])",
+                         std::ranges::to<std::string>(values));
+    }
+
+    std::println(
+        output_,
+        R"({{"type": "{}", "iteration": {}, "phase": "{}", )"
+        R"("seconds": {:.3f}, "simulations_per_second": {:.1f}, )"
+        R"("evaluations_per_second": {:.1f}, "average_batch_size": {:.2f}, )"
+        R"("moves_per_game": {:.1f}, "games_per_hour": {:.1f}, )"
+        R"("training_samples_per_second": {:.1f}{}}})",
+        type, iteration_, *phase_, seconds, delta.simulations / seconds,
+        delta.evaluations / seconds,
+        ratio(delta.evaluated_positions, delta.evaluations),
+        ratio(delta.moves, delta.games), delta.games * 3600.0 / seconds,
+        delta.training_samples / seconds, idle);
+    output_.flush();
+
+    last_report_totals_ = current;
+    last_report_time_ = now;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable_any wake_up_;
+
+  // A deque keeps the address of every slot stable as threads register.
+  std::deque<Counters> slots_;
+
+  std::chrono::milliseconds interval_;
+  std::ofstream output_;
+
+  int32_t iteration_ = 0;
+  std::optional<std::string> phase_;
+
+  Clock::time_point phase_start_time_;
+  Totals phase_start_totals_;
+  std::vector<double> idle_seconds_;
+
+  Clock::time_point last_report_time_;
+  Totals last_report_totals_;
+
+  // Declared last so that it is stopped and joined before anything it uses is
+  // destroyed.
+  std::jthread reporter_;
+};
+
+}  // namespace az
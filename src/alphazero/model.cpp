@@ -21,10 +21,32 @@ concept Model = std::is_base_of_v<torch::nn::Module, M> and
                     m.forward(x)
                   } -> std::same_as<std::tuple<torch::Tensor, torch::Tensor>>;
                 };
+
+// A model that can also evaluate the policy over given actions only. Its
+// `forward_legal` takes the (N, K) indices of the actions of every position,
+// padded with -1 at the end, and returns the win, draw and loss probabilities
+// with the (N, K) softmax of the policy over those actions.
+export template <typename M>
+concept SparsePolicyModel =
+    Model<M> and requires(M m, torch::Tensor x, torch::Tensor actions) {
+      {
+        m.forward_legal(x, actions)
+      } -> std::same_as<std::tuple<torch::Tensor, torch::Tensor>>;
+    };
 }  // namespace concepts
 
 namespace utils {
 
+// The softmax of the (N, K) logits of the actions in `actions`, which is
+// padded with -1 at the end. Padding gets a probability of zero.
+export auto legal_softmax(const torch::Tensor& logits,
+                          const torch::Tensor& actions) -> torch::Tensor {
+  auto padding = actions < 0;
+  return torch::softmax(
+      logits.masked_fill(padding, -std::numeric_limits<float>::infinity()), 1)
+      .masked_fill(padding, 0.0);
+}
+
 export template <concepts::Model Model>
 auto clone_model(std::shared_ptr<Model> model) -> std::shared_ptr<Model> {
   auto cloned = std::make_shared<Model>(model->config);
@@ -60,12 +60,15 @@ export class Node {
 
   constexpr Node(Player player = Player::First, Action action = -1,
                  double prior = 0.0)
-      : player(player), action(action), prior(prior) {}
+      : player(player), action(action), prior(prior), clean_prior(prior) {}
 
  public:
   Player player = Player::First;
   Action action = -1;
   double prior = 0.0;
+  // `prior` before the exploration noise of the root, so that a kept root
+  // can be searched again without the noise of the previous search.
+  double clean_prior = 0.0;
 
   NodeId parent_id = NodeId::Invalid;
 
@@ -0,0 +1,171 @@
+module;
+
+#include <torch/torch.h>
+
+export module az:parallel;
+
+import std;
+
+import :model;
+import :topology;
+
+namespace az {
+
+// Computes the gradient of a batch with one replica of the model per shard of
+// the batch, each on its own thread and cores. The gradients are summed into
+// the primary model, the one the optimizer updates, so that a step matches a
+// step on the whole batch up to the order of the additions and the dropout
+// masks. The other replicas copy the primary's parameters at every step.
+export template <concepts::Model Model>
+class DataParallel {
+ public:
+  // Mean loss of the model over a shard.
+  using Loss = std::function<torch::Tensor(Model&, const torch::Tensor&,
+                                           const torch::Tensor&,
+                                           const torch::Tensor&)>;
+
+  DataParallel(std::shared_ptr<Model> model, int32_t num_replicas,
+               int32_t cores_per_replica, Loss loss)
+      : loss_(std::move(loss)),
+        replicas_(num_replicas),
+        parameters_(num_replicas),
+        losses_(num_replicas, 0.0),
+        barrier_(num_replicas + 1) {
+    auto device = model->parameters().front().device();
+    auto placement =
+        Topology::detect().partition(num_replicas, cores_per_replica);
+    size_thread_pools(placement);
+
+    // Every replica is cloned by its own pinned worker so that its parameters
+    // live on the worker's NUMA node.
+    auto clone_mutex = std::mutex{};
+    replicas_.front() = model;
+    for (auto replica : std::views::iota(0, num_replicas)) {
+      workers_.emplace_back([&, this, replica, cores = placement[replica]] {
+        pin_thread(cores);
+        if (replica != 0) {
+          // Cloning moves the source to the CPU.
+          auto guard = std::lock_guard(clone_mutex);
+          replicas_[replica] = utils::clone_model(model);
+          replicas_[replica]->to(device);
+          replicas_[replica]->train();
+        }
+        barrier_.arrive_and_wait();
+        work(replica);
+      });
+    }
+
+    barrier_.arrive_and_wait();
+    model->to(device);
+    for (auto [replica, parameters] : std::views::zip(replicas_, parameters_))
+      parameters = replica->parameters();
+  }
+
+  DataParallel(const DataParallel&) = delete;
+  auto operator=(const DataParallel&) -> DataParallel& = delete;
+
+  ~DataParallel() {
+    is_stopping_ = true;
+    barrier_.arrive_and_wait();
+  }
+
+  // Leaves the gradient of the mean loss over the batch in the primary model
+  // and returns that loss.
+  auto backward(const torch::Tensor& feature, const torch::Tensor& value,
+                const torch::Tensor& policy) -> double {
+    auto num_replicas = static_cast<int64_t>(replicas_.size());
+    batch_size_ = feature.size(0);
+    features_ = feature.chunk(num_replicas);
+    values_ = value.chunk(num_replicas);
+    policies_ = policy.chunk(num_replicas);
+
+    // Computing the gradients, then reducing them.
+    barrier_.arrive_and_wait();
+    barrier_.arrive_and_wait();
+    barrier_.arrive_and_wait();
+
+    return std::ranges::fold_left(losses_, 0.0, std::plus{});
+  }
+
+ private:
+  auto work(int32_t replica) -> void {
+    auto& parameters = parameters_[replica];
+
+    while (true) {
+      barrier_.arrive_and_wait();
+      if (is_stopping_)
+        return;
+
+      auto num_shards = static_cast<int32_t>(features_.size());
+      losses_[replica] = 0.0;
+
+      {
+        torch::NoGradGuard no_grad;
+        for (auto [parameter, primary] :
+             std::views::zip(parameters, parameters_.front())) {
+          if (replica != 0)
+            parameter.copy_(primary);
+          if (parameter.grad().defined())
+            parameter.mutable_grad().zero_();
+        }
+      }
+
+      if (replica < num_shards) {
+        auto& feature = features_[replica];
+        // Weighting each shard by its size turns the sum of the shard
+        // gradients into the gradient of the whole batch.
+        auto weight = static_cast<double>(feature.size(0)) / batch_size_;
+        auto loss = loss_(*replicas_[replica], feature, values_[replica],
+                          policies_[replica]) *
+                    weight;
+        loss.backward();
+        losses_[replica] = loss.template item<double>();
+      }
+
+      barrier_.arrive_and_wait();
+
+      // Every replica sums a strided slice of the parameters across the
+      // replicas, a reduce-scatter into the primary.
+      {
+        torch::NoGradGuard no_grad;
+        auto num_parameters = parameters.size();
+        for (auto i = static_cast<size_t>(replica); i < num_parameters;
+             i += replicas_.size()) {
+          auto& primary = parameters_.front()[i];
+          for (auto other : std::views::iota(1, num_shards)) {
+            auto& gradient = parameters_[other][i].grad();
+            if (not gradient.defined())
+              continue;
+
+            if (primary.grad().defined())
+              primary.mutable_grad().add_(gradient);
+            else
+              primary.mutable_grad() = gradient.clone();
+          }
+        }
+      }
+
+      barrier_.arrive_and_wait();
+    }
+  }
+
+  Loss loss_;
+  std::vector<std::shared_ptr<Model>> replicas_;
+  std::vector<std::vector<torch::Tensor>> parameters_;
+
+  // Written by the calling thread between steps, read by the workers.
+  int64_t batch_size_ = 0;
+  std::vector<torch::Tensor> features_;
+  std::vector<torch::Tensor> values_;
+  std::vector<torch::Tensor> policies_;
+  bool is_stopping_ = false;
+
+  std::vector<double> losses_;
+
+  std::barrier<> barrier_;
+  // Declared last so that the workers are joined before anything they use is
+  // destroyed.
+  std::vector<std::jthread> workers_;
+};
+
+}  // namespace az
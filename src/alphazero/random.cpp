@@ -0,0 +1,65 @@
+module;
+
+#include <torch/torch.h>
+
+export module az:random;
+
+import std;
+
+import :game;
+
+namespace az {
+
+// SplitMix64's finalizer, which turns nearby inputs into unrelated outputs.
+export constexpr auto mix(uint64_t x) -> uint64_t {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// Derives the seed of an independent stream identified by `ids` from a root
+// seed, e.g. `derive_seed(seed, iteration, game)`. The same ids always
+// give the same stream.
+export template <typename... Ids>
+constexpr auto derive_seed(uint64_t root, Ids... ids) -> uint64_t {
+  auto seed = mix(root);
+  ((seed = mix(seed ^ static_cast<uint64_t>(ids))), ...);
+  return seed;
+}
+
+export template <typename... Ids>
+auto make_generator(uint64_t root, Ids... ids) -> std::mt19937 {
+  auto seed = derive_seed(root, ids...);
+  auto sequence = std::seed_seq{static_cast<uint32_t>(seed),
+                                static_cast<uint32_t>(seed >> 32)};
+  return std::mt19937{sequence};
+}
+
+// Samples an action from a probability vector over the action space using
+// `gen` instead of libtorch's global generator.
+export auto sample_action(const torch::Tensor& probs, std::mt19937& gen)
+    -> Action {
+  auto contiguous = probs.to(torch::kFloat32).contiguous();
+  auto data = std::span(contiguous.data_ptr<float>(), contiguous.numel());
+
+  auto total = std::accumulate(data.begin(), data.end(), 0.0);
+  auto target = std::uniform_real_distribution<double>(0.0, total)(gen);
+
+  auto last_possible = Action{0};
+  auto cumulative = 0.0;
+  for (auto action = Action{0}; action < std::ssize(data); action++) {
+    if (data[action] <= 0)
+      continue;
+
+    cumulative += data[action];
+    last_possible = action;
+    if (target < cumulative)
+      return last_possible;
+  }
+
+  // Rounding can leave the target just past the last bucket.
+  return last_possible;
+}
+
+}  // namespace az
@@ -0,0 +1,253 @@
+module;
+
+#include <assert.h>
+#include <torch/torch.h>
+
+export module az:record;
+
+import std;
+
+import :game;
+
+namespace az {
+
+// A played game as its moves, which is all it takes to replay it from the
+// initial position where `first_player` moves first. Initial positions are
+// assumed to only differ by the player to move.
+export struct GameRecord {
+  struct Move {
+    Action action = 0;
+    // The search policy of the position as (action, probability) pairs,
+    // empty when the move was not searched.
+    std::vector<std::pair<Action, float32_t>> policy;
+  };
+
+  Player first_player = Player::First;
+  // For `first_player`.
+  GameOutcome outcome = GameOutcome::Draw;
+  std::vector<Move> moves;
+};
+
+// The nonzero entries of a policy over every action.
+export auto sparse_policy(const torch::Tensor& policy)
+    -> std::vector<std::pair<Action, float32_t>> {
+  auto values = policy.to(torch::kCPU, torch::kFloat32).contiguous();
+  auto sparse = std::vector<std::pair<Action, float32_t>>{};
+  for (auto [action, value] :
+       std::views::enumerate(std::span(values.data_ptr<float>(),
+                                       values.numel()))) {
+    if (value > 0)
+      sparse.emplace_back(static_cast<Action>(action), value);
+  }
+  return sparse;
+}
+
+export auto dense_policy(std::span<const std::pair<Action, float32_t>> policy,
+                         int32_t action_size) -> torch::Tensor {
+  auto dense = torch::zeros(action_size, torch::kFloat32);
+  auto values = dense.data_ptr<float>();
+  for (auto [action, value] : policy)
+    values[action] = value;
+  return dense;
+}
+
+// Replays `record` from its initial position, calling `visit` with every
+// position and the move played from it. Returns the final position.
+export template <concepts::Game Game, typename Visit>
+auto replay(const GameRecord& record, Visit&& visit) -> typename Game::State {
+  auto state = Game::initial_state();
+  state.player = record.first_player;
+  for (auto& move : record.moves) {
+    visit(std::as_const(state), move);
+    state = Game::apply_action(state, move.action);
+  }
+  return state;
+}
+
+// The training samples of the searched moves of `record`, encoded as
+// self-play encodes them: the position, its outcome for the player to move
+// and the search policy.
+export template <concepts::Game Game>
+auto training_samples(const GameRecord& record)
+    -> std::vector<std::tuple<torch::Tensor, torch::Tensor, torch::Tensor>> {
+  auto samples =
+      std::vector<std::tuple<torch::Tensor, torch::Tensor, torch::Tensor>>{};
+  replay<Game>(record, [&](const typename Game::State& state,
+                           const GameRecord::Move& move) {
+    if (move.policy.empty())
+      return;
+
+    auto outcome = state.player == record.first_player
+                       ? record.outcome
+                       : record.outcome.flip();
+    samples.emplace_back(Game::encode_state(state), outcome.as_tensor(),
+                         dense_policy(move.policy, Game::ActionSize));
+  });
+  return samples;
+}
+
+namespace detail {
+
+constexpr auto RecordVersion = uint8_t{1};
+
+auto write_varint(std::string& bytes, uint64_t value) -> void {
+  while (value >= 0x80) {
+    bytes.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  bytes.push_back(static_cast<char>(value));
+}
+
+// Reads from `bytes` and advances it, nullopt when it ends too early.
+auto read_varint(std::string_view& bytes) -> std::optional<uint64_t> {
+  auto value = uint64_t{0};
+  for (auto shift = 0; shift < 64; shift += 7) {
+    if (bytes.empty())
+      return std::nullopt;
+    auto byte = static_cast<uint8_t>(bytes.front());
+    bytes.remove_prefix(1);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (not (byte & 0x80))
+      return value;
+  }
+  return std::nullopt;
+}
+
+}  // namespace detail
+
+// Appends game records to a file, safe to share across threads. A record is
+// written as
+//
+//   varint size of the rest
+//   u8 version, u8 first player (1 or 0), u8 outcome + 1
+//   varint number of moves
+//   per move: varint action, varint policy size and per policy entry a
+//   varint action and a u16 probability in 1/65535ths
+//
+// so a game without policies takes a few hundred bytes.
+export class RecordWriter {
+ public:
+  explicit RecordWriter(std::string path) : path_(std::move(path)) {
+    if (auto directory = std::filesystem::path(path_).parent_path();
+        not directory.empty())
+      std::filesystem::create_directories(directory);
+
+    output_.open(path_, std::ios::binary | std::ios::app);
+    if (not output_)
+      throw std::runtime_error(
+          std::format("Cannot write game records {}.", path_));
+  }
+
+  auto write(const GameRecord& record) -> void {
+    auto body = std::string{};
+    body.push_back(static_cast<char>(detail::RecordVersion));
+    body.push_back(record.first_player.is_first() ? 1 : 0);
+    body.push_back(static_cast<char>(record.outcome.as_scalar() + 1));
+    detail::write_varint(body, record.moves.size());
+    for (auto& move : record.moves) {
+      detail::write_varint(body, move.action);
+      detail::write_varint(body, move.policy.size());
+      for (auto [action, probability] : move.policy) {
+        detail::write_varint(body, action);
+        auto quantized = static_cast<uint16_t>(
+            std::lround(std::clamp(probability, 0.0f, 1.0f) * 65535.0f));
+        body.push_back(static_cast<char>(quantized & 0xff));
+        body.push_back(static_cast<char>(quantized >> 8));
+      }
+    }
+
+    auto header = std::string{};
+    detail::write_varint(header, body.size());
+
+    auto guard = std::lock_guard(mutex_);
+    output_ << header << body;
+    output_.flush();
+  }
+
+ private:
+  std::string path_;
+  std::mutex mutex_;
+  std::ofstream output_;
+};
+
+// Reads the records of a file written by `RecordWriter` in order.
+export class RecordReader {
+ public:
+  explicit RecordReader(std::string path)
+      : path_(std::move(path)), input_(path_, std::ios::binary) {
+    if (not input_)
+      throw std::runtime_error(
+          std::format("Cannot open game records {}.", path_));
+  }
+
+  // Nullopt at the end of the file.
+  auto next() -> std::optional<GameRecord> {
+    auto size = uint64_t{0};
+    for (auto shift = 0;; shift += 7) {
+      auto byte = input_.get();
+      if (byte == std::char_traits<char>::eof()) {
+        if (shift == 0)
+          return std::nullopt;
+        throw corrupted();
+      }
+      size |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (not (byte & 0x80))
+        break;
+    }
+
+    buffer_.resize(size);
+    if (not input_.read(buffer_.data(), size))
+      throw corrupted();
+
+    auto bytes = std::string_view(buffer_);
+    if (bytes.size() < 3 or
+        static_cast<uint8_t>(bytes[0]) != detail::RecordVersion)
+      throw corrupted();
+
+    auto record = GameRecord{};
+    record.first_player = bytes[1] == 1 ? Player::First : Player::Second;
+    record.outcome = bytes[2] == 2   ? GameOutcome::Win
+                     : bytes[2] == 1 ? GameOutcome::Draw
+                                     : GameOutcome::Loss;
+    bytes.remove_prefix(3);
+
+    auto num_moves = detail::read_varint(bytes);
+    if (not num_moves)
+      throw corrupted();
+
+    for (auto _ : std::views::iota(uint64_t{0}, *num_moves)) {
+      auto action = detail::read_varint(bytes);
+      auto policy_size = detail::read_varint(bytes);
+      if (not action or not policy_size)
+        throw corrupted();
+
+      auto& move = record.moves.emplace_back();
+      move.action = static_cast<Action>(*action);
+      for (auto _ : std::views::iota(uint64_t{0}, *policy_size)) {
+        auto policy_action = detail::read_varint(bytes);
+        if (not policy_action or bytes.size() < 2)
+          throw corrupted();
+
+        auto quantized = static_cast<uint8_t>(bytes[0]) |
+                         static_cast<uint8_t>(bytes[1]) << 8;
+        bytes.remove_prefix(2);
+        move.policy.emplace_back(static_cast<Action>(*policy_action),
+                                 quantized / 65535.0f);
+      }
+    }
+
+    return record;
+  }
+
+ private:
+  auto corrupted() const -> std::runtime_error {
+    return std::runtime_error(
+        std::format("Corrupted game record in {}.", path_));
+  }
+
+  std::string path_;
+  std::ifstream input_;
+  std::string buffer_;
+};
+
+}  // namespace az
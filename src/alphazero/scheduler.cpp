@@ -0,0 +1,85 @@
+module;
+
+#include <assert.h>
+
+export module az:scheduler;
+
+import std;
+
+namespace az {
+
+// Hands out the games of a phase to a fixed set of workers. The games are
+// first dealt evenly into one deque per worker. A worker takes games from the
+// back of its own deque and, once it is empty, steals from the front of the
+// others', so a phase ends as soon as its quota is played instead of when the
+// worker with the longest games is done.
+export class GameScheduler {
+  using Clock = std::chrono::steady_clock;
+
+  // Padded so that workers locking their own deques do not share a line.
+  struct alignas(64) Queue {
+    std::mutex mutex;
+    std::deque<int32_t> games;
+    // When the worker found no game left anywhere.
+    Clock::time_point finish_time;
+  };
+
+ public:
+  GameScheduler(int32_t num_games, int32_t num_workers)
+      : queues_(std::max(1, num_workers)) {
+    for (auto game : std::views::iota(0, num_games))
+      queues_[game % queues_.size()].games.push_back(game);
+  }
+
+  // The next game of `worker`, or nothing once every game has been taken.
+  auto next(int32_t worker) -> std::optional<int32_t> {
+    assert(worker >= 0 and worker < std::ssize(queues_));
+    auto& own = queues_[worker];
+    {
+      auto guard = std::lock_guard(own.mutex);
+      if (not own.games.empty()) {
+        auto game = own.games.back();
+        own.games.pop_back();
+        return game;
+      }
+    }
+
+    auto num_queues = queues_.size();
+    for (auto offset : std::views::iota(size_t{1}, num_queues)) {
+      auto& victim = queues_[(worker + offset) % num_queues];
+      auto guard = std::lock_guard(victim.mutex);
+      if (not victim.games.empty()) {
+        auto game = victim.games.front();
+        victim.games.pop_front();
+        num_steals_.fetch_add(1, std::memory_order_relaxed);
+        return game;
+      }
+    }
+
+    // Games are never added back, so the worker is done for the phase.
+    own.finish_time = Clock::now();
+    return std::nullopt;
+  }
+
+  // Seconds every worker waited between running out of games and the last
+  // worker running out. Only valid once every worker is done.
+  auto idle_seconds() const -> std::vector<double> {
+    auto end =
+        std::ranges::max_element(queues_, {}, &Queue::finish_time)->finish_time;
+    auto seconds = std::vector<double>{};
+    for (auto& queue : queues_)
+      seconds.push_back(
+          std::chrono::duration<double>(end - queue.finish_time).count());
+    return seconds;
+  }
+
+  auto num_steals() const -> uint64_t {
+    return num_steals_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::vector<Queue> queues_;
+  std::atomic<uint64_t> num_steals_{0};
+};
+
+}  // namespace az
@@ -47,6 +47,8 @@ export class NodeStorage {
 
   constexpr auto clear() -> void { nodes_.clear(); }
 
+  constexpr auto is_empty() const -> bool { return nodes_.empty(); }
+
   constexpr auto as_ref(NodeId id) -> NodeRef { return NodeRef(*this, id); }
 
   constexpr auto get(NodeId id) -> Node& {
@@ -59,6 +61,37 @@ export class NodeStorage {
     return nodes_[id.value()];
   }
 
+  // A copy of the subtree of `root_id` with its root as the first node. Nodes
+  // are copied breadth first so that siblings stay contiguous.
+  auto subtree(NodeId root_id) const -> NodeStorage {
+    auto subtree = NodeStorage{};
+    auto copy = [&](NodeId id) {
+      auto& node = get(id);
+      auto new_id = subtree.create(node.player, node.action, node.prior);
+      subtree.get(new_id).clean_prior = node.clean_prior;
+      subtree.get(new_id).value = node.value;
+      subtree.get(new_id).visits = node.visits;
+      return new_id;
+    };
+
+    auto queue = std::deque<std::pair<NodeId, NodeId>>{};
+    queue.emplace_back(root_id, copy(root_id));
+    while (not queue.empty()) {
+      auto [id, new_id] = queue.front();
+      queue.pop_front();
+      if (not get(id).is_expanded())
+        continue;
+
+      for (auto child_id : get(id).children()) {
+        auto new_child_id = copy(child_id);
+        subtree.get(new_id).add_child(new_child_id);
+        subtree.get(new_child_id).parent_id = new_id;
+        queue.emplace_back(child_id, new_child_id);
+      }
+    }
+    return subtree;
+  }
+
  private:
   std::vector<Node> nodes_;
 };
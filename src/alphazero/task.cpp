@@ -0,0 +1,132 @@
+module;
+
+#include <assert.h>
+
+export module az:task;
+
+import std;
+
+namespace az {
+
+export template <typename T = void>
+class Task;
+
+namespace detail {
+
+template <typename T>
+struct Promise;
+
+template <typename T>
+struct PromiseBase {
+  // Resumed when the task completes, the awaiting task if there is one.
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr exception;
+
+  struct FinalAwaiter {
+    auto await_ready() noexcept -> bool { return false; }
+    auto await_suspend(std::coroutine_handle<Promise<T>> handle) noexcept
+        -> std::coroutine_handle<> {
+      return handle.promise().continuation;
+    }
+    auto await_resume() noexcept -> void {}
+  };
+
+  auto get_return_object() -> Task<T> {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(
+        static_cast<Promise<T>&>(*this)));
+  }
+
+  auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+  auto final_suspend() noexcept -> FinalAwaiter { return {}; }
+  auto unhandled_exception() -> void { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase<T> {
+  std::optional<T> value;
+
+  auto return_value(T result) -> void { value = std::move(result); }
+};
+
+template <>
+struct Promise<void> : PromiseBase<void> {
+  auto return_void() -> void {}
+};
+
+}  // namespace detail
+
+// A lazily started coroutine returning a `T`. Awaiting a task runs it until
+// it completes and then resumes the awaiting coroutine, without going through
+// a scheduler, so a chain of tasks only ever suspends where one of them awaits
+// something else. The outermost task is started and resumed with `resume`.
+export template <typename T>
+class [[nodiscard]] Task {
+ public:
+  using promise_type = detail::Promise<T>;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  Task(Task&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  auto operator=(Task&& other) noexcept -> Task& {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  auto resume() -> void {
+    assert(handle_ and not handle_.done());
+    handle_.resume();
+  }
+
+  auto is_done() const -> bool { return handle_.done(); }
+
+  // Rethrows the exception the task ended with. Only valid once it is done.
+  auto result() -> T {
+    assert(is_done());
+    auto& promise = handle_.promise();
+    if (promise.exception)
+      std::rethrow_exception(promise.exception);
+    if constexpr (std::is_void_v<T>)
+      return;
+    else
+      return std::move(*promise.value);
+  }
+
+  auto operator co_await() {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      auto await_ready() -> bool { return false; }
+      auto await_suspend(std::coroutine_handle<> awaiting)
+          -> std::coroutine_handle<> {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+      auto await_resume() -> T {
+        auto& promise = handle.promise();
+        if (promise.exception)
+          std::rethrow_exception(promise.exception);
+        if constexpr (std::is_void_v<T>)
+          return;
+        else
+          return std::move(*promise.value);
+      }
+    };
+    return Awaiter{handle_};
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+}  // namespace az
@@ -0,0 +1,250 @@
+module;
+
+#include <pthread.h>
+#include <sched.h>
+#include <torch/torch.h>
+
+export module az:topology;
+
+import std;
+
+import :model;
+
+namespace az {
+
+// CPUs a thread is pinned to, all on the same NUMA node.
+export struct CoreSet {
+  int32_t node = 0;
+  std::vector<int32_t> cpus;
+};
+
+// The NUMA nodes of the machine and the CPUs of each that the process may run
+// on, read from sysfs. Without sysfs the machine is a single node.
+export class Topology {
+ public:
+  // Detected once, from the affinity of the first caller.
+  static auto detect() -> const Topology& {
+    static const auto topology = Topology();
+    return topology;
+  }
+
+  auto num_nodes() const -> int32_t {
+    return static_cast<int32_t>(nodes_.size());
+  }
+
+  auto num_cpus() const -> int32_t {
+    auto num_cpus = size_t{0};
+    for (auto& cpus : nodes_)
+      num_cpus += cpus.size();
+    return static_cast<int32_t>(num_cpus);
+  }
+
+  // Every CPU of `node`.
+  auto node_cores(int32_t node) const -> CoreSet {
+    return {.node = node, .cpus = nodes_[node]};
+  }
+
+  // How many actors of `cores_per_actor` cores fill the machine.
+  auto num_actors(int32_t cores_per_actor = 1) const -> int32_t {
+    return std::max(1, num_cpus() / std::max(1, cores_per_actor));
+  }
+
+  // Splits the machine into `num_parts` core sets. The parts are spread over
+  // the nodes in proportion to their CPUs, and the parts of a node take
+  // consecutive CPUs, so that hyperthreads of a core go to the same part.
+  // With 0 cores per part the CPUs of a node are divided evenly between its
+  // parts. Parts wrap around and share CPUs when there are not enough.
+  auto partition(int32_t num_parts, int32_t cores_per_part = 0) const
+      -> std::vector<CoreSet> {
+    auto parts = std::vector<CoreSet>{};
+    auto total = static_cast<int64_t>(num_cpus());
+    auto before = int64_t{0};
+
+    for (auto [node, cpus] : std::views::zip(std::views::iota(0), nodes_)) {
+      auto size = static_cast<int32_t>(cpus.size());
+      auto first = num_parts * before / total;
+      before += size;
+      auto last = num_parts * before / total;
+
+      auto num_node_parts = static_cast<int32_t>(last - first);
+      if (num_node_parts == 0)
+        continue;
+
+      auto width = cores_per_part > 0 ? cores_per_part
+                                      : std::max(1, size / num_node_parts);
+      for (auto part : std::views::iota(0, num_node_parts)) {
+        auto set = CoreSet{.node = node};
+        for (auto i : std::views::iota(0, std::min(width, size)))
+          set.cpus.push_back(cpus[(part * width + i) % size]);
+        parts.push_back(std::move(set));
+      }
+    }
+
+    return parts;
+  }
+
+ private:
+  Topology() {
+    auto allowed = allowed_cpus();
+
+    for (auto node = 0;; node++) {
+      auto list = read_file(
+          std::format("/sys/devices/system/node/node{}/cpulist", node));
+      if (not list)
+        break;
+
+      auto cpus = std::vector<int32_t>{};
+      for (auto cpu : parse_cpu_list(*list)) {
+        if (allowed.contains(cpu))
+          cpus.push_back(cpu);
+      }
+      if (not cpus.empty())
+        nodes_.push_back(std::move(cpus));
+    }
+
+    if (nodes_.empty())
+      nodes_.emplace_back(allowed.begin(), allowed.end());
+
+    // Hyperthreads of the same core are made adjacent.
+    for (auto& cpus : nodes_) {
+      auto cores = std::map<int32_t, int32_t>{};
+      for (auto cpu : cpus) {
+        auto siblings = read_file(std::format(
+            "/sys/devices/system/cpu/cpu{}/topology/thread_siblings_list",
+            cpu));
+        auto list = siblings ? parse_cpu_list(*siblings) : std::vector{cpu};
+        cores[cpu] = list.empty() ? cpu : list.front();
+      }
+      std::ranges::sort(cpus, {}, [&](int32_t cpu) {
+        return std::pair{cores[cpu], cpu};
+      });
+    }
+  }
+
+  static auto allowed_cpus() -> std::set<int32_t> {
+    auto allowed = std::set<int32_t>{};
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (auto cpu : std::views::iota(0, CPU_SETSIZE)) {
+        if (CPU_ISSET(cpu, &set))
+          allowed.insert(cpu);
+      }
+    }
+
+    if (allowed.empty()) {
+      auto num_cpus = std::max(1u, std::thread::hardware_concurrency());
+      for (auto cpu : std::views::iota(0, static_cast<int32_t>(num_cpus)))
+        allowed.insert(cpu);
+    }
+
+    return allowed;
+  }
+
+  static auto read_file(const std::string& path)
+      -> std::optional<std::string> {
+    auto input = std::ifstream(path);
+    auto line = std::string{};
+    if (not input or not std::getline(input, line))
+      return std::nullopt;
+    return line;
+  }
+
+  // Parses lists such as "0-3,8-11".
+  static auto parse_cpu_list(std::string_view list) -> std::vector<int32_t> {
+    auto cpus = std::vector<int32_t>{};
+    for (auto range : std::views::split(list, ',')) {
+      auto text = std::string_view(range);
+      auto dash = text.find('-');
+      auto first = 0;
+      auto [_, error] =
+          std::from_chars(text.data(), text.data() + text.size(), first);
+      if (error != std::errc{})
+        continue;
+
+      auto last = first;
+      if (dash != std::string_view::npos)
+        std::from_chars(text.data() + dash + 1, text.data() + text.size(),
+                        last);
+      for (auto cpu : std::views::iota(first, last + 1))
+        cpus.push_back(cpu);
+    }
+    return cpus;
+  }
+
+  std::vector<std::vector<int32_t>> nodes_;
+};
+
+// Sizes libtorch's pools for threads pinned to `placement`. The intra-op
+// thread count is process wide, so it is set once to the smallest core set,
+// before the pinned threads start, instead of by each of them.
+export auto size_thread_pools(std::span<const CoreSet> placement) -> void {
+  // Nothing here forks TorchScript tasks, so the inter-op pool only adds
+  // threads competing for the cores.
+  static auto once = std::once_flag{};
+  std::call_once(once, [] {
+    try {
+      at::set_num_interop_threads(1);
+    } catch (const c10::Error&) {
+      // The pool was already started.
+    }
+  });
+
+  if (placement.empty())
+    return;
+
+  auto smallest = std::ranges::min(
+      placement | std::views::transform([](const CoreSet& cores) {
+        return cores.cpus.size();
+      }));
+  at::set_num_threads(std::max(1, static_cast<int32_t>(smallest)));
+}
+
+// Restricts the calling thread, and the threads it creates from now on, to
+// `cores`. Memory the thread touches first from now on, such as the nodes of
+// a search tree, is allocated on its node by the kernel's first-touch policy.
+export auto pin_thread(const CoreSet& cores) -> bool {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cores.cpus)
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// A copy of a CPU model for every NUMA node, each cloned by a thread pinned to
+// its node so that the parameters are allocated in the node's memory. On a
+// single node, or on another device, every node shares the model itself.
+export template <concepts::Model Model>
+class NodeReplicas {
+ public:
+  explicit NodeReplicas(std::shared_ptr<Model> model) {
+    auto& topology = Topology::detect();
+    auto is_cpu = model->parameters().front().device().is_cpu();
+    if (topology.num_nodes() == 1 or not is_cpu) {
+      replicas_.push_back(model);
+      return;
+    }
+
+    auto is_training = model->is_training();
+    for (auto node : std::views::iota(0, topology.num_nodes())) {
+      // Cloning moves the source to the CPU, so the clones run one at a time.
+      std::jthread([&] {
+        pin_thread(topology.node_cores(node));
+        auto replica = utils::clone_model(model);
+        replica->train(is_training);
+        replicas_.push_back(replica);
+      }).join();
+    }
+  }
+
+  auto get(int32_t node) const -> std::shared_ptr<Model> {
+    return replicas_[node % replicas_.size()];
+  }
+
+ private:
+  std::vector<std::shared_ptr<Model>> replicas_;
+};
+
+}  // namespace az
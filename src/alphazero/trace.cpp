@@ -0,0 +1,187 @@
+module;
+
+#include <assert.h>
+
+export module az:trace;
+
+import std;
+
+// Scoped spans written in Chrome's trace event format, which can be opened in
+// Perfetto or chrome://tracing with one track per thread.
+//
+// Spans are buffered per thread without any synchronization and written out
+// by `Tracer::flush`, which must only be called while no other thread is
+// recording, e.g. between the phases of an iteration.
+
+namespace az::trace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  const char* name;
+  int64_t start_us;
+  int64_t duration_us;
+};
+
+struct ThreadBuffer {
+  int32_t tid;
+  std::string name;
+  bool is_name_written = false;
+  std::vector<Event> events;
+
+  // Depth of the sampled spans currently open on this thread and whether the
+  // outermost one was picked by the sampler.
+  int32_t sampled_depth = 0;
+  bool is_sampling = false;
+  double sample_credit = 0.0;
+};
+
+export class Tracer {
+ public:
+  static auto instance() -> Tracer& {
+    static auto tracer = Tracer{};
+    return tracer;
+  }
+
+  // Starts writing spans to `path`. Only `sample_rate` of the outermost
+  // sampled spans of each thread are recorded, together with every span
+  // nested inside them.
+  auto start(std::string_view path, double sample_rate) -> void {
+    auto guard = std::lock_guard(mutex_);
+    output_.open(std::string(path), std::ios::trunc);
+    // The array format allows the closing bracket to be missing, which lets
+    // us append events as they are flushed.
+    std::println(output_, "[");
+    sample_rate_ = std::clamp(sample_rate, 0.0, 1.0);
+    enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  auto is_enabled() const -> bool {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  auto flush() -> void {
+    if (not is_enabled())
+      return;
+
+    auto guard = std::lock_guard(mutex_);
+    for (auto& buffer : buffers_) {
+      if (not buffer->is_name_written and not buffer->name.empty()) {
+        std::println(output_,
+                     R"({{"name": "thread_name", "ph": "M", "pid": 0, )"
+                     R"("tid": {}, "args": {{"name": "{}"}}}},)",
+                     buffer->tid, buffer->name);
+        buffer->is_name_written = true;
+      }
+
+      for (auto& event : buffer->events) {
+        std::println(output_,
+                     R"({{"name": "{}", "ph": "X", "pid": 0, "tid": {}, )"
+                     R"("ts": {}, "dur": {}}},)",
+                     event.name, buffer->tid, event.start_us,
+                     event.duration_us);
+      }
+      buffer->events.clear();
+    }
+
+    // Buffers of threads that have exited are not needed anymore.
+    std::erase_if(buffers_, [](auto& buffer) {
+      return buffer.use_count() == 1 and buffer->events.empty();
+    });
+
+    output_.flush();
+  }
+
+  auto now_us() const -> int64_t {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               Clock::now() - origin_)
+        .count();
+  }
+
+  auto buffer() -> ThreadBuffer& {
+    thread_local auto buffer = std::shared_ptr<ThreadBuffer>{};
+    if (not buffer) {
+      auto guard = std::lock_guard(mutex_);
+      buffer = std::make_shared<ThreadBuffer>(next_tid_++);
+      buffers_.push_back(buffer);
+    }
+    return *buffer;
+  }
+
+  auto should_sample(ThreadBuffer& buffer) const -> bool {
+    buffer.sample_credit += sample_rate_;
+    if (buffer.sample_credit < 1.0)
+      return false;
+    buffer.sample_credit -= 1.0;
+    return true;
+  }
+
+ private:
+  Tracer() = default;
+
+  std::atomic<bool> enabled_{false};
+  double sample_rate_ = 1.0;
+  Clock::time_point origin_ = Clock::now();
+
+  std::mutex mutex_;
+  std::ofstream output_;
+  int32_t next_tid_ = 0;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+};
+
+// Names the track of the calling thread.
+export auto name_thread(std::string name) -> void {
+  auto& tracer = Tracer::instance();
+  if (tracer.is_enabled())
+    tracer.buffer().name = std::move(name);
+}
+
+export class Span {
+ public:
+  // Sampled spans are meant for the hot paths, unsampled ones are always
+  // recorded while tracing is enabled. `name` must outlive the trace.
+  explicit Span(const char* name, bool sampled = false) : name_(name) {
+    auto& tracer = Tracer::instance();
+    if (not tracer.is_enabled())
+      return;
+
+    auto& buffer = tracer.buffer();
+    if (sampled) {
+      if (buffer.sampled_depth++ == 0)
+        buffer.is_sampling = tracer.should_sample(buffer);
+      sampled_ = true;
+
+      if (not buffer.is_sampling)
+        return;
+    }
+
+    start_us_ = tracer.now_us();
+  }
+
+  Span(const Span&) = delete;
+  auto operator=(const Span&) -> Span& = delete;
+
+  ~Span() {
+    if (not sampled_ and start_us_ < 0)
+      return;
+
+    auto& tracer = Tracer::instance();
+    auto& buffer = tracer.buffer();
+
+    if (sampled_) {
+      assert(buffer.sampled_depth > 0);
+      buffer.sampled_depth--;
+    }
+
+    if (start_us_ >= 0)
+      buffer.events.push_back(
+          {name_, start_us_, tracer.now_us() - start_us_});
+  }
+
+ private:
+  const char* name_;
+  int64_t start_us_ = -1;
+  bool sampled_ = false;
+};
+
+}  // namespace az::trace
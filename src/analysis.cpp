@@ -0,0 +1,281 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <torch/torch.h>
+#include <unistd.h>
+
+import az;
+import dz;
+import std;
+
+// Serves analysis requests for one model on a Unix domain socket, so that
+// tools can send many queries without loading the model for each of them.
+//
+// Usage: DamathZeroAnalysis MODEL [--socket PATH] [--workers N]
+//                           [--in-flight N] [--simulations N]
+//
+// Every line a client sends is a request:
+//
+//   evaluate <notation> [priority N] [deadline MS]
+//       replies wdl <w> <d> <l> policy <move>:<p>...
+//   search <notation> [nodes N] [priority N] [deadline MS]
+//       replies bestmove <move> nodes <simulations> policy <move>:<p>...
+//
+// where `<notation>` is a position as written by `dz::to_notation` and the
+// deadline is in milliseconds from when the request is read. A request that
+// fails replies error <reason>. Replies come in the order of the requests, but
+// a client does not have to wait for a reply before sending more requests, and
+// the requests of every client share the same forward passes.
+
+struct Options {
+  std::string socket = "damathzero.sock";
+  int32_t num_workers = 1;
+  int32_t max_in_flight = 64;
+  int32_t num_simulations = 800;
+};
+
+using Clock = dz::AnalysisPool::Clock;
+
+// Splits what a client sends into lines.
+class LineReader {
+ public:
+  explicit LineReader(int fd) : fd_(fd) {}
+
+  auto next() -> std::optional<std::string> {
+    while (true) {
+      if (auto end = buffer_.find('\n'); end != std::string::npos) {
+        auto line = buffer_.substr(0, end);
+        buffer_.erase(0, end + 1);
+        return line;
+      }
+
+      auto chunk = std::array<char, 4096>{};
+      auto size = ::read(fd_, chunk.data(), chunk.size());
+      if (size <= 0)
+        return std::nullopt;
+      buffer_.append(chunk.data(), size);
+    }
+  }
+
+ private:
+  int fd_;
+  std::string buffer_;
+};
+
+// Returns false once the client is gone.
+auto write_all(int fd, std::string_view text) -> bool {
+  while (not text.empty()) {
+    auto size = ::send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+    if (size <= 0)
+      return false;
+    text.remove_prefix(size);
+  }
+  return true;
+}
+
+auto listen_on(const std::string& path) -> int {
+  auto address = sockaddr_un{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    throw std::runtime_error(std::format("Socket path {} is too long.", path));
+  std::ranges::copy(path, address.sun_path);
+
+  // A socket left behind by a previous server.
+  ::unlink(path.c_str());
+
+  auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 or
+      ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 or
+      ::listen(fd, SOMAXCONN) < 0)
+    throw std::runtime_error(std::format("Cannot listen on {}.", path));
+  return fd;
+}
+
+auto format_policy(const dz::Game::State& state, const torch::Tensor& policy)
+    -> std::string {
+  auto text = std::string{"policy"};
+  for (auto action : dz::Game::legal_action_list(state))
+    text += std::format(" {}:{:.4f}", dz::format_action(state, action),
+                        policy[action].item<float>());
+  return text;
+}
+
+// Submits the request of `line` to `pool`, the reply is ready once its
+// analysis is.
+auto handle(std::string_view line, dz::AnalysisPool& pool,
+            const Options& options) -> std::future<std::string> {
+  auto fail = [](std::string_view reason) {
+    auto reply = std::promise<std::string>{};
+    reply.set_value(std::format("error {}", reason));
+    return reply.get_future();
+  };
+
+  auto stream = std::istringstream(std::string(line));
+  auto words = std::vector<std::string>{};
+  for (auto word = std::string{}; stream >> word;)
+    words.push_back(word);
+
+  if (words.size() < 6 or (words[0] != "evaluate" and words[0] != "search"))
+    return fail("expected evaluate or search and a position");
+
+  auto is_search = words[0] == "search";
+  auto state =
+      dz::from_notation(std::ranges::subrange(words.begin() + 1,
+                                              words.begin() + 6) |
+                        std::views::join_with(' ') |
+                        std::ranges::to<std::string>());
+  if (not state)
+    return fail("cannot parse position");
+  if (dz::Game::legal_action_list(*state).empty())
+    return fail("no legal moves");
+
+  auto request = dz::AnalysisPool::Request{
+      .state = *state,
+      .num_simulations = is_search ? options.num_simulations : 0};
+  // The options come in pairs of a name and a number.
+  if (words.size() % 2 != 0)
+    return fail(std::format("expected a number after {}", words.back()));
+  for (auto i = 6uz; i < words.size(); i += 2) {
+    auto& name = words[i];
+    auto& text = words[i + 1];
+    auto value = int32_t{0};
+    auto [_, error] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc{})
+      return fail(std::format("expected a number after {}", name));
+
+    if (name == "priority")
+      request.priority = value;
+    else if (name == "deadline")
+      request.deadline = Clock::now() + std::chrono::milliseconds(value);
+    else if (name == "nodes" and is_search)
+      request.num_simulations = std::max(1, value);
+    else
+      return fail(std::format("unknown option {}", name));
+  }
+
+  auto result = pool.submit(request);
+  return std::async(
+      std::launch::deferred,
+      [state = *state, result = std::move(result)]() mutable -> std::string {
+        try {
+          auto analysis = result.get();
+          if (analysis.wdl) {
+            auto wdl = analysis.wdl->to(torch::kFloat32);
+            return std::format("wdl {:.4f} {:.4f} {:.4f} {}",
+                               wdl[0].item<float>(), wdl[1].item<float>(),
+                               wdl[2].item<float>(),
+                               format_policy(state, analysis.policy));
+          }
+
+          auto action = torch::argmax(analysis.policy).item<dz::Action>();
+          return std::format("bestmove {} nodes {} {}",
+                             dz::format_action(state, action),
+                             analysis.num_simulations,
+                             format_policy(state, analysis.policy));
+        } catch (const std::exception& error) {
+          return std::format("error {}", error.what());
+        }
+      });
+}
+
+// Reads the requests of a client until it disconnects. Replies are written
+// by a second thread as they become ready, in the order of the requests.
+auto serve(int client, dz::AnalysisPool& pool, const Options& options)
+    -> void {
+  auto mutex = std::mutex{};
+  auto has_reply = std::condition_variable{};
+  auto replies = std::deque<std::future<std::string>>{};
+  auto is_closed = false;
+
+  auto writer = std::jthread([&] {
+    auto is_connected = true;
+    while (true) {
+      auto lock = std::unique_lock(mutex);
+      has_reply.wait(lock, [&] { return is_closed or not replies.empty(); });
+      if (replies.empty())
+        return;
+
+      auto reply = std::move(replies.front());
+      replies.pop_front();
+      lock.unlock();
+
+      // Still waited for once the client is gone, so that the analyses do
+      // not outlive `serve`.
+      auto line = reply.get() + "\n";
+      is_connected = is_connected and write_all(client, line);
+    }
+  });
+
+  auto reader = LineReader(client);
+  while (auto line = reader.next()) {
+    auto reply = handle(*line, pool, options);
+    {
+      auto guard = std::lock_guard(mutex);
+      replies.push_back(std::move(reply));
+    }
+    has_reply.notify_one();
+  }
+
+  {
+    auto guard = std::lock_guard(mutex);
+    is_closed = true;
+  }
+  has_reply.notify_one();
+  writer.join();
+  ::close(client);
+}
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 2) {
+    std::println(std::cerr, "Expected the model path.");
+    return -1;
+  }
+
+  auto options = Options{};
+  for (auto i = 2; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--socket" and has_value)
+      options.socket = argv[++i];
+    else if (flag == "--workers" and has_value)
+      options.num_workers = std::stoi(argv[++i]);
+    else if (flag == "--in-flight" and has_value)
+      options.max_in_flight = std::stoi(argv[++i]);
+    else if (flag == "--simulations" and has_value)
+      options.num_simulations = std::stoi(argv[++i]);
+    else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  auto model = dz::load_model(argv[1], {});
+  model->eval();
+
+  // Every worker gets its own engine, which is not thread safe, over the
+  // same weights.
+  auto weights = std::make_shared<const dz::InferenceWeights>(*model);
+  auto make_forward = [weights, &options] {
+    auto engine = std::make_shared<dz::InferenceEngine>(
+        weights, dz::InferenceEngine::Config{.max_batch_size =
+                                                 options.max_in_flight});
+    return dz::AnalysisPool::LegalForward(
+        [engine](const torch::Tensor& features, const torch::Tensor& actions) {
+          return engine->forward_legal(features, actions);
+        });
+  };
+
+  auto pool = dz::AnalysisPool(make_forward,
+                               {.num_workers = options.num_workers,
+                                .max_in_flight = options.max_in_flight});
+
+  auto server = listen_on(options.socket);
+  std::println(std::cerr, "Listening on {}.", options.socket);
+
+  while (true) {
+    auto client = ::accept(server, nullptr, nullptr);
+    if (client < 0)
+      continue;
+    std::thread(serve, client, std::ref(pool), std::cref(options)).detach();
+  }
+}
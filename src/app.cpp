@@ -5,26 +5,44 @@ import std;
 
 auto Update(dz::Application&) -> void;
 auto Render(const dz::Application&) -> void;
+auto RenderSearchProgress(const dz::Application&) -> void;
+
+// Usage: DamathZeroApp MODEL [OPENING_BOOK] [--records PATH]
+//
+// With --records every finished game is appended to PATH.
 
 auto main(int argc, char* argv[]) -> int {
-  if (argc < 2) {
+  auto arguments = std::vector<std::string_view>{};
+  auto game_records_path = std::optional<std::string>{};
+  for (auto i = 1; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    if (flag == "--records" and i + 1 < argc)
+      game_records_path = argv[++i];
+    else if (flag.starts_with("--")) {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    } else
+      arguments.push_back(flag);
+  }
+
+  if (arguments.empty()) {
     std::println(std::cerr, "Expected model path as the first argument.");
     return -1;
   }
 
+  auto opening_book_path = std::optional<std::string>{};
+  if (arguments.size() > 1)
+    opening_book_path = std::string(arguments[1]);
+
   auto app = dz::Application{{
                                  .num_simulations = 1000,
                                  .device = dz::DeviceType::CPU,
+                                 .opening_book_path = opening_book_path,
+                                 .search_progress_interval = 32,
+                                 .game_records_path = game_records_path,
                              },
-                             {
-                                 .action_size = dz::Game::ActionSize,
-                                 .num_blocks = 10,
-                                 .num_attention_head = 4,
-                                 .embedding_dim = 64,
-                                 .mlp_hidden_size = 128,
-                                 .mlp_dropout_prob = 0.1,
-                             },
-                             argv[1]};
+                             {},
+                             arguments[0]};
 
   InitWindow(1330, 830, "DamathZero");
   SetTargetFPS(60);
@@ -38,8 +56,19 @@ auto main(int argc, char* argv[]) -> int {
 }
 
 auto Update(dz::Application& app) -> void {
-  if (app.state.player.is_second() and not app.outcome.has_value())
-    app.let_ai_move();
+  app.search_progress.refresh();
+
+  // The AI searches in the background so that the window keeps drawing, the
+  // position cannot change until it moves.
+  if (app.is_ai_thinking()) {
+    app.finish_ai_move();
+    return;
+  }
+
+  if (app.state.player.is_second() and not app.outcome.has_value()) {
+    app.start_ai_move();
+    return;
+  }
 
   if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
     auto mousePosition = GetMousePosition();
@@ -159,6 +188,8 @@ auto Render(const dz::Application& app) -> void {
                    WHITE);
   }
 
+  RenderSearchProgress(app);
+
   DrawRectangle(855, 650, 200, 50, GREEN);
   DrawTextCenter(GetFontDefault(), "Undo", 855, 650, 200, 50, 40, 3, WHITE);
 
@@ -167,3 +198,49 @@ auto Render(const dz::Application& app) -> void {
 
   EndDrawing();
 }
+
+// The moves of the running search as arrows weighted by their visits, and its
+// most visited moves and line in the side panel.
+auto RenderSearchProgress(const dz::Application& app) -> void {
+  auto& progress = app.search_progress.front();
+  if (progress.children.empty() or
+      progress.position != dz::Game::hash(app.state))
+    return;
+
+  auto center = [](auto position) {
+    auto [x, y] = position.value();
+    return Vector2{x * 100.0f + 50, (7 - y) * 100.0f + 50};
+  };
+
+  auto total_visits = std::max(1, progress.num_simulations);
+  for (auto& child : progress.children) {
+    if (child.visits == 0)
+      continue;
+
+    auto share = static_cast<float>(child.visits) / total_visits;
+    auto info = dz::Game::decode_action(app.state, child.action);
+    DrawLineEx(center(info.original_position), center(info.new_position),
+               2 + 10 * share, Fade(SKYBLUE, 0.3f + 0.7f * share));
+  }
+
+  DrawTextCenter(GetFontDefault(),
+                 std::format("{} simulations", progress.num_simulations), 830,
+                 400, 500, 40, 20, 3, WHITE);
+
+  for (auto [row, child] :
+       std::views::enumerate(progress.children | std::views::take(4))) {
+    DrawTextCenter(GetFontDefault(),
+                   std::format("{}  {:6} visits  Q {:.2f}",
+                               dz::format_action(app.state, child.action),
+                               child.visits, child.q),
+                   830, 440 + row * 30, 500, 30, 20, 3, WHITE);
+  }
+
+  auto line = std::string{"PV"};
+  auto state = app.state;
+  for (auto action : progress.principal_variation | std::views::take(6)) {
+    line += " " + dz::format_action(state, action);
+    state = dz::Game::apply_action(state, action);
+  }
+  DrawTextCenter(GetFontDefault(), line, 830, 570, 500, 40, 20, 3, WHITE);
+}
@@ -0,0 +1,373 @@
+#include <torch/torch.h>
+
+import az;
+import dz;
+import std;
+
+// Benchmarks the hot paths of self-play on a fixed corpus of positions and
+// prints one JSON object per benchmark so runs can be diffed across builds.
+//
+// Usage: DamathZeroBench [--seed N] [--games N] [--simulations N]
+//                        [--records PATH]... [--min-time S] [--filter NAME]
+//
+// The corpus is every position of the games in the records, or of seeded
+// self-play games searched by the benchmarked model otherwise.
+
+struct Options {
+  uint32_t seed = 42;
+  int32_t num_games = 32;
+  int32_t num_simulations = 16;
+  std::vector<std::string> records;
+  float64_t min_time = 0.5;
+  std::string filter = "";
+};
+
+static auto options = Options{};
+
+// Printed at exit so the optimizer cannot discard the benchmarked calls.
+static int64_t sink = 0;
+
+template <typename Pass>
+auto benchmark(std::string_view name, int64_t param, int64_t ops_per_pass,
+               Pass&& pass) -> void {
+  if (not options.filter.empty() and not name.contains(options.filter))
+    return;
+
+  // Warm up caches and libtorch's lazily initialized kernels.
+  pass();
+
+  auto num_ops = int64_t{0};
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::duration<float64_t>{0};
+  do {
+    pass();
+    num_ops += ops_per_pass;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed.count() < options.min_time);
+
+  auto seconds = elapsed.count();
+  std::println(
+      R"({{"benchmark": "{}", "param": {}, "ops": {}, "seconds": {:.6f}, )"
+      R"("ns_per_op": {:.1f}, "ops_per_second": {:.1f}}})",
+      name, param, num_ops, seconds, seconds * 1e9 / num_ops,
+      num_ops / seconds);
+}
+
+// Plays seeded self-play games the way training does, with Dirichlet noise
+// at the root and the moves sampled from the search, and keeps every
+// position along the way. The model is untrained, but the positions still
+// follow the search rather than uniformly random moves.
+auto gather_corpus(std::shared_ptr<dz::Model> model, uint32_t seed,
+                   int32_t num_games, int32_t num_simulations)
+    -> std::vector<dz::Game::State> {
+  auto weights = std::make_shared<const dz::InferenceWeights>(*model);
+  auto engine = dz::InferenceEngine(weights, {.max_batch_size = 1});
+  auto forward = [&](const torch::Tensor& features,
+                     const torch::Tensor& actions) {
+    return engine.forward_legal(features, actions);
+  };
+
+  auto mcts = dz::MCTS{{.num_simulations = num_simulations}};
+  auto corpus = std::vector<dz::Game::State>{};
+  for (auto game : std::views::iota(0, num_games)) {
+    auto gen = az::make_generator(seed, game);
+    auto state = dz::Game::initial_state(gen);
+    while (true) {
+      corpus.push_back(state);
+
+      auto probs = mcts.search(state, forward, std::nullopt, &gen);
+      auto action = az::sample_action(probs, gen);
+
+      auto new_state = dz::Game::apply_action(state, action);
+      if (dz::Game::get_outcome(new_state, action))
+        break;
+
+      state = std::move(new_state);
+    }
+  }
+
+  return corpus;
+}
+
+// Every position played in the records.
+auto load_corpus(std::span<const std::string> paths)
+    -> std::vector<dz::Game::State> {
+  auto corpus = std::vector<dz::Game::State>{};
+  for (auto& path : paths) {
+    auto reader = az::RecordReader(path);
+    while (auto record = reader.next()) {
+      az::replay<dz::Game>(*record, [&](const dz::Game::State& state,
+                                        const az::GameRecord::Move&) {
+        corpus.push_back(state);
+      });
+    }
+  }
+  return corpus;
+}
+
+auto main(int argc, char** argv) -> int {
+  for (auto i = 1; i + 1 < argc; i += 2) {
+    auto flag = std::string_view{argv[i]};
+    if (flag == "--seed")
+      options.seed = std::stoul(argv[i + 1]);
+    else if (flag == "--games")
+      options.num_games = std::stoi(argv[i + 1]);
+    else if (flag == "--simulations")
+      options.num_simulations = std::stoi(argv[i + 1]);
+    else if (flag == "--records")
+      options.records.emplace_back(argv[i + 1]);
+    else if (flag == "--min-time")
+      options.min_time = std::stod(argv[i + 1]);
+    else if (flag == "--filter")
+      options.filter = argv[i + 1];
+    else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  torch::manual_seed(options.seed);
+  torch::NoGradGuard no_grad;
+
+  auto model = std::make_shared<dz::Model>(dz::Model::Config{});
+  model->eval();
+
+  auto corpus = options.records.empty()
+                    ? gather_corpus(model, options.seed, options.num_games,
+                                    options.num_simulations)
+                    : load_corpus(options.records);
+  if (corpus.empty()) {
+    std::println(std::cerr, "Expected positions in the records.");
+    return -1;
+  }
+  auto num_positions = static_cast<int64_t>(corpus.size());
+
+  // Every (position, action) pair from the corpus, split by whether the
+  // action captures a piece.
+  auto moves = std::vector<std::pair<dz::Game::State, dz::Action>>{};
+  auto captures = std::vector<std::pair<dz::Game::State, dz::Action>>{};
+  for (auto& state : corpus) {
+    auto actions = dz::Game::legal_actions(state).nonzero();
+    for (auto i = 0; i < actions.size(0); i++) {
+      auto action = actions[i].item<dz::Action>();
+      moves.emplace_back(state, action);
+      if (not dz::Game::decode_action(state, action)
+                  .eaten_enemy_position.is_empty())
+        captures.emplace_back(state, action);
+    }
+  }
+
+  std::println(std::cerr, "Corpus: {} positions, {} moves, {} captures.",
+               corpus.size(), moves.size(), captures.size());
+
+  benchmark("legal_actions", 0, num_positions, [&] {
+    for (auto& state : corpus)
+      sink += dz::Game::legal_actions(state).numel();
+  });
+
+  // The same positions through the batched move generator, in batches of
+  // the sizes of a batched search.
+  for (auto kernels : dz::supported_kernels()) {
+    auto name = std::format("generate_moves_{}", dz::to_string(kernels));
+    for (auto batch_size : {int64_t{64}, int64_t{1024}}) {
+      auto batches = std::vector<dz::StateBatch>{};
+      for (auto start = int64_t{0}; start < num_positions; start += batch_size)
+        batches.emplace_back(std::span(corpus).subspan(
+            start, std::min(batch_size, num_positions - start)));
+
+      benchmark(name, batch_size, num_positions, [&] {
+        for (auto& batch : batches) {
+          for (auto& generated : dz::generate_moves(batch, kernels))
+            sink += generated.is_capture;
+        }
+      });
+    }
+  }
+
+  benchmark("apply_action", 0, moves.size(), [&] {
+    for (auto& [state, action] : moves)
+      sink += dz::Game::apply_action(state, action).draw_count;
+  });
+
+  benchmark("get_outcome", 0, moves.size(), [&] {
+    for (auto& [state, action] : moves)
+      sink += dz::Game::get_outcome(dz::Game::apply_action(state, action),
+                                    action)
+                  .has_value();
+  });
+
+  benchmark("encode_state", 0, num_positions, [&] {
+    for (auto& state : corpus)
+      sink += dz::Game::encode_state(state).numel();
+  });
+
+  benchmark("get_max_eats", 0, captures.size(), [&] {
+    for (auto& [state, action] : captures)
+      sink += dz::Game::get_max_eats(state, action);
+  });
+
+  auto gen = std::mt19937{options.seed};
+  auto memory = az::Memory{gen};
+  for (auto& state : corpus)
+    memory.append(dz::Game::encode_state(state),
+                  dz::GameOutcome::Draw.as_tensor(),
+                  dz::Game::legal_actions(state));
+
+  for (auto batch_size : {size_t{64}, size_t{256}}) {
+    auto num_batches = static_cast<int64_t>(memory.size() / batch_size);
+    benchmark("sample_batch", batch_size, num_batches * batch_size, [&] {
+      for (auto start = size_t{0}; start + batch_size <= memory.size();
+           start += batch_size) {
+        auto [feature, value, policy] = memory.sample_batch(batch_size, start);
+        sink += feature.size(0);
+      }
+    });
+  }
+
+  auto make_batch = [&](int32_t batch_size) {
+    auto features = std::vector<torch::Tensor>{};
+    for (auto i : std::views::iota(0, batch_size))
+      features.push_back(dz::Game::encode_state(corpus[i % num_positions]));
+    return torch::stack(features, 0);
+  };
+
+  // The legal actions of the same positions, padded with -1.
+  auto make_actions = [&](int32_t batch_size) {
+    auto actions = std::vector<torch::Tensor>{};
+    auto num_actions = int64_t{0};
+    for (auto i : std::views::iota(0, batch_size)) {
+      auto& state = corpus[i % num_positions];
+      actions.push_back(dz::Game::legal_actions(state).nonzero().flatten());
+      num_actions = std::max(num_actions, actions.back().size(0));
+    }
+
+    auto padded = torch::full({batch_size, num_actions}, -1, torch::kInt64);
+    for (auto [i, legal] : std::views::enumerate(actions))
+      padded[i].slice(0, 0, legal.size(0)).copy_(legal);
+    return padded;
+  };
+
+  // The policy `forward_legal` has to match, from the full logits.
+  auto legal_policy = [](const torch::Tensor& logits,
+                         const torch::Tensor& actions) {
+    return az::utils::legal_softmax(logits.gather(1, actions.clamp_min(0)),
+                                    actions);
+  };
+
+  for (auto batch_size : {1, 8, 32, 128, 512}) {
+    auto batch = make_batch(batch_size);
+    benchmark("model_forward", batch_size, batch_size, [&] {
+      auto [wdl, policy] = model->forward(batch);
+      sink += wdl.size(0);
+    });
+
+    auto actions = make_actions(batch_size);
+    benchmark("model_forward_legal", batch_size, batch_size, [&] {
+      auto [wdl, policy] = model->forward_legal(batch, actions);
+      sink += wdl.size(0);
+    });
+  }
+
+  // The engine has to agree with libtorch before its speed means anything,
+  // so every kernel set the CPU supports is checked on the same batches.
+  auto weights = std::make_shared<const dz::InferenceWeights>(*model);
+  for (auto kernels : dz::supported_kernels()) {
+    auto engine = dz::InferenceEngine(
+        weights, {.max_batch_size = 512, .kernels = kernels});
+    auto name = std::format("inference_{}", dz::to_string(kernels));
+    auto legal_name = std::format("inference_legal_{}", dz::to_string(kernels));
+
+    for (auto batch_size : {1, 8, 32, 128, 512}) {
+      auto batch = make_batch(batch_size);
+      auto [expected_wdl, expected_policy] = [&] {
+        torch::NoGradGuard no_grad;
+        return model->forward(batch);
+      }();
+      auto [wdl, policy] = engine.forward(batch);
+
+      auto actions = make_actions(batch_size);
+      auto expected_legal = legal_policy(expected_policy, actions);
+      auto [model_wdl, model_legal] = [&] {
+        torch::NoGradGuard no_grad;
+        return model->forward_legal(batch, actions);
+      }();
+      auto [legal_wdl, legal] = engine.forward_legal(batch, actions);
+
+      auto error = std::ranges::max({
+          (wdl - expected_wdl).abs().max().item<float>(),
+          (policy - expected_policy).abs().max().item<float>(),
+          (legal_wdl - expected_wdl).abs().max().item<float>(),
+          (legal - expected_legal).abs().max().item<float>(),
+          (model_legal - expected_legal).abs().max().item<float>(),
+      });
+      if (error > 1e-3f) {
+        std::println(std::cerr,
+                     "The {} kernels are off by {} at batch size {}.",
+                     dz::to_string(kernels), error, batch_size);
+        return -1;
+      }
+
+      auto features = std::span(batch.data_ptr<float>(),
+                                static_cast<size_t>(batch.numel()));
+      benchmark(name, batch_size, batch_size, [&] {
+        engine.run(features, batch_size);
+        sink += engine.wdl(batch_size).size();
+      });
+
+      auto indices = std::span(actions.data_ptr<int64_t>(),
+                               static_cast<size_t>(actions.numel()));
+      benchmark(legal_name, batch_size, batch_size, [&] {
+        engine.run_legal(features, indices, actions.size(1), batch_size);
+        sink += engine.wdl(batch_size).size();
+      });
+    }
+  }
+
+  // Searches start from a spread of corpus positions so that both openings
+  // and endgames are covered.
+  for (auto num_simulations : {100, 400}) {
+    auto mcts = dz::MCTS{{.num_simulations = num_simulations}};
+    auto stride = std::max<int64_t>(1, num_positions / 8);
+    benchmark("mcts_search", num_simulations, 8 * num_simulations, [&] {
+      for (auto i : std::views::iota(0, 8)) {
+        auto probs = mcts.search(corpus[(i * stride) % num_positions], model);
+        sink += probs.size(0);
+      }
+    });
+
+    auto engine = dz::InferenceEngine(weights, {.max_batch_size = 1});
+    auto forward = [&](const torch::Tensor& features,
+                       const torch::Tensor& actions) {
+      return engine.forward_legal(features, actions);
+    };
+    benchmark("mcts_search_inference", num_simulations, 8 * num_simulations,
+              [&] {
+                for (auto i : std::views::iota(0, 8)) {
+                  auto probs = mcts.search(
+                      corpus[(i * stride) % num_positions], forward);
+                  sink += probs.size(0);
+                }
+              });
+  }
+
+  // Every search gets a fresh engine so that each pass visits the same nodes,
+  // which makes the rate nodes per second.
+  for (auto depth : {4, 6}) {
+    auto config = dz::AlphaBeta::Config{.max_depth = depth,
+                                        .table_size = size_t{1} << 16};
+    auto stride = std::max<int64_t>(1, num_positions / 8);
+    auto search_spread = [&] {
+      auto nodes = uint64_t{0};
+      for (auto i : std::views::iota(0, 8)) {
+        auto engine = dz::AlphaBeta{config};
+        nodes += engine.search(corpus[(i * stride) % num_positions]).nodes;
+      }
+      return nodes;
+    };
+
+    auto nodes = static_cast<int64_t>(search_spread());
+    benchmark("alpha_beta", depth, nodes, [&] { sink += search_spread(); });
+  }
+
+  std::println(std::cerr, "Checksum: {}", sink);
+}
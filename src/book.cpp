@@ -0,0 +1,90 @@
+#include <torch/torch.h>
+
+import az;
+import dz;
+import std;
+
+// Builds an opening book from the root visit distributions of games played by
+// a model against itself.
+//
+// Usage: DamathZeroBook MODEL OUTPUT [--games N] [--depth N]
+//                       [--simulations N] [--threads N] [--min-games N]
+//                       [--seed N]
+
+struct Options {
+  int32_t num_games = 1000;
+  int32_t depth = 12;
+  int32_t num_simulations = 1000;
+  int32_t num_threads = 4;
+  int32_t min_games = 8;
+  uint64_t seed = 42;
+};
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 3) {
+    std::println(std::cerr, "Expected the model and output paths.");
+    return -1;
+  }
+
+  auto options = Options{};
+  for (auto i = 3; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--games" and has_value)
+      options.num_games = std::stoi(argv[++i]);
+    else if (flag == "--depth" and has_value)
+      options.depth = std::stoi(argv[++i]);
+    else if (flag == "--simulations" and has_value)
+      options.num_simulations = std::stoi(argv[++i]);
+    else if (flag == "--threads" and has_value)
+      options.num_threads = std::stoi(argv[++i]);
+    else if (flag == "--min-games" and has_value)
+      options.min_games = std::stoi(argv[++i]);
+    else if (flag == "--seed" and has_value)
+      options.seed = std::stoull(argv[++i]);
+    else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  auto model = dz::load_model(argv[1], {});
+  model->eval();
+
+  auto builder = dz::OpeningBookBuilder{};
+  auto next_game = std::atomic<int32_t>{0};
+
+  auto threads = std::vector<std::thread>{};
+  for (auto _ : std::views::iota(0, options.num_threads)) {
+    threads.emplace_back([&] {
+      auto mcts = dz::MCTS{{.num_simulations = options.num_simulations}};
+      for (auto game = next_game++; game < options.num_games;
+           game = next_game++) {
+        // The root noise and the sampled moves spread the games over the
+        // openings the model considers.
+        auto gen = az::make_generator(options.seed, game);
+        auto state = dz::Game::initial_state(gen);
+
+        for (auto ply : std::views::iota(0, options.depth)) {
+          auto policy = mcts.search(state, model, std::nullopt, &gen);
+          builder.add(state, ply, policy);
+
+          auto action = az::sample_action(policy, gen);
+          auto new_state = dz::Game::apply_action(state, action);
+          if (dz::Game::get_outcome(new_state, action))
+            break;
+
+          state = std::move(new_state);
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto num_written = builder.write(argv[2], options.min_games);
+  std::println("Wrote {} of {} positions to {}.", num_written,
+               builder.num_positions(), argv[2]);
+}
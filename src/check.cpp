@@ -0,0 +1,212 @@
+#include <torch/torch.h>
+
+import az;
+import dz;
+import std;
+
+// Checks invariants that a training run or a benchmark would not notice
+// breaking. Prints every check and exits with 1 when any of them fails.
+//
+// Usage: DamathZeroCheck [--filter NAME]
+
+struct Check {
+  std::string_view name;
+  auto (*run)() -> bool;
+};
+
+// `Memory::reanalyse` finds a position by its id after `pop` left a gap in the
+// ids, including the newest position.
+auto check_reanalyse_after_pop() -> bool {
+  auto gen = std::mt19937{0};
+  auto memory = az::Memory<int32_t>{gen};
+  auto append = [&](int32_t position) {
+    memory.append(torch::zeros(1), torch::zeros(3),
+                  torch::full({1}, static_cast<float>(position)), position);
+  };
+
+  // Ids 0 to 3, then 3 is popped and 4 and 5 follow.
+  for (auto position : std::views::iota(0, 4))
+    append(position);
+  memory.pop();
+  append(4);
+  append(5);
+
+  memory.reanalyse(3, torch::full({1}, -3.0f));
+  memory.reanalyse(4, torch::full({1}, -4.0f));
+  memory.reanalyse(5, torch::full({1}, -5.0f));
+
+  auto policies = std::get<2>(memory.sample_batch(memory.size(), 0)).flatten();
+  auto expected = torch::tensor({0.0f, 1.0f, 2.0f, -4.0f, -5.0f});
+  if (torch::equal(policies, expected))
+    return true;
+
+  for (auto i : std::views::iota(int64_t{0}, expected.size(0)))
+    std::println("  position {}: policy {}, expected {}", i,
+                 policies[i].item<float>(), expected[i].item<float>());
+  return false;
+}
+
+// Positions only become stale once a newer best model was promoted, not with
+// every iteration.
+auto check_stale_positions() -> bool {
+  auto gen = std::mt19937{0};
+  auto memory = az::Memory<int32_t>{gen, {.max_iterations = 3}};
+  memory.begin_iteration(0, /*model_version=*/0);
+  for (auto position : std::views::iota(0, 4))
+    memory.append(torch::zeros(1), torch::zeros(3), torch::zeros(1), position);
+
+  memory.begin_iteration(1, /*model_version=*/0);
+  auto without_promotion = memory.stale_positions(10).size();
+  memory.begin_iteration(2, /*model_version=*/1);
+  auto after_promotion = memory.stale_positions(10).size();
+  if (without_promotion == 0 and after_promotion == 4)
+    return true;
+
+  std::println("  {} stale without a promotion, {} after one, expected 0 and 4",
+               without_promotion, after_promotion);
+  return false;
+}
+
+// Positions of seeded random games, with their legal actions padded with -1.
+auto random_positions(int32_t num_positions)
+    -> std::tuple<torch::Tensor, torch::Tensor> {
+  auto gen = std::mt19937{0};
+  auto states = std::vector<dz::Game::State>{};
+  auto state = dz::Game::initial_state(gen);
+  while (std::ssize(states) < num_positions) {
+    states.push_back(state);
+
+    auto actions = dz::Game::legal_action_list(state);
+    auto action = actions[gen() % actions.size()];
+    auto new_state = dz::Game::apply_action(state, action);
+    state = dz::Game::get_outcome(new_state, action)
+                ? dz::Game::initial_state(gen)
+                : std::move(new_state);
+  }
+
+  auto features = std::vector<torch::Tensor>{};
+  auto legal = std::vector<torch::Tensor>{};
+  auto num_actions = int64_t{0};
+  for (auto& state : states) {
+    features.push_back(dz::Game::encode_state(state));
+    legal.push_back(dz::Game::legal_actions(state).nonzero().flatten());
+    num_actions = std::max(num_actions, legal.back().size(0));
+  }
+
+  auto actions = torch::full({num_positions, num_actions}, -1, torch::kInt64);
+  for (auto [i, position_actions] : std::views::enumerate(legal))
+    actions[i].slice(0, 0, position_actions.size(0)).copy_(position_actions);
+  return {torch::stack(features, 0), actions};
+}
+
+// `InferenceEngine` computes what libtorch computes with every kernel set the
+// CPU supports, through `forward` and `forward_legal`, for batches below,
+// at and above its maximum batch size.
+auto check_inference_engine() -> bool {
+  auto model = std::make_shared<dz::Model>(dz::Model::Config{});
+  model->eval();
+
+  auto weights = std::make_shared<const dz::InferenceWeights>(*model);
+  auto [all_features, all_actions] = random_positions(100);
+
+  auto passed = true;
+  for (auto kernels : dz::supported_kernels()) {
+    auto engine = dz::InferenceEngine(
+        weights, {.max_batch_size = 32, .kernels = kernels});
+
+    for (auto batch_size : {1, 7, 32, 100}) {
+      auto features = all_features.slice(0, 0, batch_size);
+      auto actions = all_actions.slice(0, 0, batch_size);
+
+      auto [expected_wdl, expected_policy] = model->forward(features);
+      auto [wdl, policy] = engine.forward(features);
+      auto [expected_legal_wdl, expected_legal] =
+          model->forward_legal(features, actions);
+      auto [legal_wdl, legal] = engine.forward_legal(features, actions);
+
+      auto errors = std::array{
+          std::pair{"forward wdl", (wdl - expected_wdl).abs().max()},
+          std::pair{"forward policy", (policy - expected_policy).abs().max()},
+          std::pair{"forward_legal wdl",
+                    (legal_wdl - expected_legal_wdl).abs().max()},
+          std::pair{"forward_legal policy",
+                    (legal - expected_legal).abs().max()},
+      };
+      for (auto& [output, error] : errors) {
+        if (error.item<float>() <= 1e-3f)
+          continue;
+
+        std::println("  {} kernels, batch size {}: {} off by {}",
+                     dz::to_string(kernels), batch_size, output,
+                     error.item<float>());
+        passed = false;
+      }
+    }
+  }
+  return passed;
+}
+
+// `from_notation` only accepts a capture in progress by a piece of the player
+// to move that jumped there along a diagonal, anything else would reach the
+// assertions of the move generation.
+auto check_notation_capture_square() -> bool {
+  // The first player moves and owns b3, c4 is empty and b7 is the opponent's.
+  auto notation = dz::to_notation(dz::Game::initial_state());
+  notation.pop_back();
+
+  auto cases = std::array<std::pair<std::string_view, bool>, 5>{{
+      {"b3/d5", true},
+      {"c4/a2", false},
+      {"b7/d5", false},
+      {"b3/b5", false},
+      {"b3/c4", false},
+  }};
+
+  auto passed = true;
+  for (auto [squares, is_valid] : cases) {
+    auto state = dz::from_notation(notation + std::string(squares));
+    if (state.has_value() == is_valid)
+      continue;
+
+    std::println("  {}: {}, expected {}", squares,
+                 state ? "accepted" : "rejected",
+                 is_valid ? "accepted" : "rejected");
+    passed = false;
+  }
+  return passed;
+}
+
+static const auto checks = std::vector<Check>{
+    {"reanalyse_after_pop", check_reanalyse_after_pop},
+    {"stale_positions", check_stale_positions},
+    {"inference_engine", check_inference_engine},
+    {"notation_capture_square", check_notation_capture_square},
+};
+
+auto main(int argc, char** argv) -> int {
+  auto filter = std::string_view{};
+  for (auto i = 1; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    if (flag == "--filter" and i + 1 < argc)
+      filter = argv[++i];
+    else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  torch::manual_seed(0);
+  torch::NoGradGuard no_grad;
+
+  auto num_failed = 0;
+  for (auto& [name, run] : checks) {
+    if (not filter.empty() and not name.contains(filter))
+      continue;
+
+    auto passed = run();
+    std::println("{}: {}", name, passed ? "passed" : "failed");
+    num_failed += passed ? 0 : 1;
+  }
+
+  return num_failed > 0 ? 1 : 0;
+}
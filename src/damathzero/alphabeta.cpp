@@ -0,0 +1,344 @@
+module;
+
+#include <torch/torch.h>
+
+#include <cassert>
+
+export module dz:alphabeta;
+
+import :board;
+import :game;
+import :movegen;
+
+import az;
+import std;
+
+namespace dz {
+
+// Classical searcher: negamax alpha-beta with iterative deepening, a
+// transposition table and a material-and-score evaluation. It is far weaker
+// than a trained network but each node costs a few microseconds instead of a
+// forward pass, which makes it a cheap source of bootstrap games and a
+// fixed-strength opponent.
+export class AlphaBeta {
+  using State = Game::State;
+  using Clock = std::chrono::steady_clock;
+
+  enum class Bound : uint8_t { Exact, Lower, Upper };
+
+  struct Entry {
+    uint64_t hash = 0;
+    float32_t score = 0;
+    Action action = -1;
+    int8_t depth = -1;
+    Bound bound = Bound::Exact;
+  };
+
+  // The legal actions of a node, on the stack so that searching a node never
+  // allocates.
+  struct ActionList {
+    // More than any position has: 12 pieces reaching at most 13 squares each.
+    static constexpr auto Capacity = 12uz * 13;
+
+    std::array<Action, Capacity> actions;
+    size_t size = 0;
+
+    explicit ActionList(const ActionMask& mask) {
+      movegen::for_each_action(mask, [this](Action action) {
+        assert(size < Capacity);
+        actions[size++] = action;
+      });
+    }
+
+    auto span() -> std::span<Action> { return {actions.data(), size}; }
+  };
+
+  // Scores of decided games lie beyond any evaluation.
+  static constexpr auto WinScore = 10000.0f;
+  static constexpr auto Infinity = std::numeric_limits<float32_t>::infinity();
+
+  // Evaluation bonus of every piece and of every knighted piece on top of
+  // their value, since they keep the capture opportunities alive.
+  static constexpr auto PieceWeight = 1.0f;
+  static constexpr auto KnightWeight = 2.0f;
+
+ public:
+  struct Config {
+    // Depth in moves, the continuation of a capture sequence is free.
+    int32_t max_depth = 6;
+    // Once exceeded, the deepest completed iteration is returned.
+    std::optional<std::chrono::milliseconds> time_limit = std::nullopt;
+    // Rounded up to a power of two.
+    size_t table_size = size_t{1} << 20;
+    // Temperature, in points, of the softmax turning root scores into a
+    // policy.
+    float32_t temperature = 2.0;
+  };
+
+  struct Result {
+    Action action;
+    float32_t score;
+    int32_t depth;
+    uint64_t nodes;
+    std::vector<std::pair<Action, float32_t>> root_scores;
+  };
+
+  explicit AlphaBeta(Config config)
+      : config_(config), table_(std::bit_ceil(config.table_size)) {}
+
+  // Every root action is searched with a full window so that all the root
+  // scores are exact, not only the best one.
+  auto search(const State& state) -> Result {
+    auto actions = Game::legal_action_list(state);
+    assert(not actions.empty());
+
+    nodes_ = 0;
+    is_aborted_ = false;
+    deadline_ = std::nullopt;
+    if (config_.time_limit)
+      deadline_ = Clock::now() + *config_.time_limit;
+
+    auto result = Result{.action = actions.front(), .score = 0, .depth = 0};
+    for (auto depth : std::views::iota(1, config_.max_depth + 1)) {
+      order_actions(state, actions, result.action);
+
+      auto root_scores = std::vector<std::pair<Action, float32_t>>{};
+      for (auto action : actions) {
+        auto score = action_score(state, action, depth, -Infinity, Infinity);
+        if (is_aborted_)
+          break;
+        root_scores.emplace_back(action, score);
+      }
+
+      if (is_aborted_)
+        break;
+
+      auto [action, score] = std::ranges::max(
+          root_scores, {}, [](auto& root_score) { return root_score.second; });
+      result = {.action = action,
+                .score = score,
+                .depth = depth,
+                .root_scores = std::move(root_scores)};
+
+      // Deeper searches cannot change a decided game.
+      if (score >= WinScore or score <= -WinScore)
+        break;
+    }
+
+    result.nodes = nodes_;
+    return result;
+  }
+
+  // Softmax of the root scores over the action space, which can serve as a
+  // policy target.
+  auto policy(const State& state) -> torch::Tensor {
+    auto result = search(state);
+
+    auto policy = torch::zeros(Game::ActionSize, torch::kFloat32);
+    if (result.root_scores.empty()) {
+      // Out of time before the first iteration completed.
+      policy[result.action] = 1.0;
+      return policy;
+    }
+
+    for (auto [action, score] : result.root_scores) {
+      auto logit = static_cast<float>((score - result.score) /
+                                      config_.temperature);
+      policy[action] = std::exp(logit);
+    }
+    return policy / policy.sum(0);
+  }
+
+ private:
+  // Score of playing `action` for the player to move in `state`.
+  auto action_score(const State& state, Action action, int32_t depth,
+                    float32_t alpha, float32_t beta) -> float32_t {
+    auto next = Game::apply_action(state, action);
+    if (next.player == state.player)
+      return negamax(next, depth, alpha, beta);
+    return -negamax(next, depth - 1, -beta, -alpha);
+  }
+
+  auto negamax(const State& state, int32_t depth, float32_t alpha,
+               float32_t beta) -> float32_t {
+    if (++nodes_ % 1024 == 0 and deadline_ and Clock::now() > *deadline_)
+      is_aborted_ = true;
+    if (is_aborted_)
+      return 0;
+
+    auto moves = generate_moves(state);
+    if (moves.is_terminal)
+      return terminal_score(state);
+
+    // Captures are mandatory, so they are searched past the horizon and the
+    // evaluation never sees a position in the middle of an exchange.
+    if (depth <= 0 and not moves.is_capture)
+      return evaluate(state);
+    depth = std::max(depth, 0);
+
+    auto hash = Game::hash(state);
+    auto& entry = table_[hash & (table_.size() - 1)];
+    auto table_action = Action{-1};
+    if (entry.hash == hash) {
+      table_action = entry.action;
+      if (entry.depth >= depth) {
+        if (entry.bound == Bound::Exact)
+          return entry.score;
+        if (entry.bound == Bound::Lower)
+          alpha = std::max(alpha, entry.score);
+        else
+          beta = std::min(beta, entry.score);
+        if (alpha >= beta)
+          return entry.score;
+      }
+    }
+
+    auto list = ActionList(moves.legal);
+    auto actions = list.span();
+    order_actions(state, actions, table_action);
+
+    auto original_alpha = alpha;
+    auto best_score = -Infinity;
+    auto best_action = actions.front();
+    for (auto action : actions) {
+      auto score = action_score(state, action, depth, alpha, beta);
+      if (score > best_score) {
+        best_score = score;
+        best_action = action;
+      }
+
+      alpha = std::max(alpha, score);
+      if (alpha >= beta)
+        break;
+    }
+
+    if (is_aborted_)
+      return 0;
+
+    auto bound = best_score <= original_alpha ? Bound::Upper
+                 : best_score >= beta         ? Bound::Lower
+                                              : Bound::Exact;
+    entry = {.hash = hash,
+             .score = best_score,
+             .action = best_action,
+             .depth = static_cast<int8_t>(std::min(depth, 127)),
+             .bound = bound};
+    return best_score;
+  }
+
+  // Tries the best action of a previous search first, then the captures that
+  // gain the most and the moves that knight a piece.
+  static auto order_actions(const State& state, std::span<Action> actions,
+                            Action first) -> void {
+    auto current = static_cast<float32_t>(
+        state.player.is_first() ? state.scores.first : state.scores.second);
+
+    auto priority = [&](Action action) -> float32_t {
+      if (action == first)
+        return Infinity;
+
+      auto info = Game::decode_action(state, action);
+      auto gain = info.new_score - current;
+      return gain + (info.should_be_knighted ? KnightWeight : 0.0f);
+    };
+
+    assert(actions.size() <= ActionList::Capacity);
+    auto priorities = std::array<float32_t, ActionList::Capacity>{};
+    for (auto i : std::views::iota(0uz, actions.size()))
+      priorities[i] = priority(actions[i]);
+
+    // An insertion sort, which is stable like `std::ranges::stable_sort`
+    // without its buffer, and the lists are short.
+    for (auto i : std::views::iota(1uz, actions.size())) {
+      auto action = actions[i];
+      auto action_priority = priorities[i];
+      auto j = i;
+      for (; j > 0 and priorities[j - 1] < action_priority; j--) {
+        actions[j] = actions[j - 1];
+        priorities[j] = priorities[j - 1];
+      }
+      actions[j] = action;
+      priorities[j] = action_priority;
+    }
+  }
+
+  static auto score_difference(const State& state) -> float32_t {
+    auto [first, second] = state.scores;
+    return static_cast<float32_t>(state.player.is_first() ? first - second
+                                                          : second - first);
+  }
+
+  // The scores and the pieces' values, as they would be counted if the game
+  // ended now, with a bonus for the pieces and knights each player keeps.
+  static auto evaluate(const State& state) -> float32_t {
+    auto score = score_difference(state);
+    for (auto& row : state.board.cells) {
+      for (auto cell : row) {
+        if (not cell.is_occupied)
+          continue;
+
+        auto value = cell.value() * (cell.is_knighted ? 2 : 1) + PieceWeight +
+                     (cell.is_knighted ? KnightWeight : 0.0f);
+        score += cell.is_owned_by(state.player) ? value : -value;
+      }
+    }
+    return score;
+  }
+
+  static auto terminal_score(const State& state) -> float32_t {
+    auto score = score_difference(state);
+    for (auto& row : state.board.cells) {
+      for (auto cell : row) {
+        if (not cell.is_occupied)
+          continue;
+
+        auto value = cell.value() * (cell.is_knighted ? 2 : 1);
+        score += cell.is_owned_by(state.player) ? value : -value;
+      }
+    }
+
+    if (score > 0)
+      return WinScore + score;
+    if (score < 0)
+      return -WinScore + score;
+    return 0;
+  }
+
+  Config config_;
+  std::vector<Entry> table_;
+
+  uint64_t nodes_ = 0;
+  bool is_aborted_ = false;
+  std::optional<Clock::time_point> deadline_;
+};
+
+// A policy usable from any number of threads at once, which keeps one engine
+// per concurrent caller so that their transposition tables stay warm.
+export auto alpha_beta_policy(AlphaBeta::Config config)
+    -> std::function<torch::Tensor(const Game::State&)> {
+  struct Pool {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<AlphaBeta>> engines;
+  };
+
+  auto pool = std::make_shared<Pool>();
+  return [config, pool](const Game::State& state) {
+    auto engine = [&] {
+      auto guard = std::lock_guard(pool->mutex);
+      if (pool->engines.empty())
+        return std::make_unique<AlphaBeta>(config);
+
+      auto engine = std::move(pool->engines.back());
+      pool->engines.pop_back();
+      return engine;
+    }();
+
+    auto policy = engine->policy(state);
+
+    auto guard = std::lock_guard(pool->mutex);
+    pool->engines.push_back(std::move(engine));
+    return policy;
+  };
+}
+
+}  // namespace dz
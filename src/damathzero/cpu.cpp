@@ -0,0 +1,48 @@
+export module dz:cpu;
+
+import std;
+
+namespace dz {
+
+// The instruction sets the vectorized kernels of the inference engine and of
+// the move generator are built for, picked at run time from what the CPU
+// supports.
+export enum class KernelSet { Scalar, Avx2, Avx512 };
+
+export auto to_string(KernelSet set) -> std::string_view {
+  switch (set) {
+    case KernelSet::Scalar:
+      return "scalar";
+    case KernelSet::Avx2:
+      return "avx2";
+    case KernelSet::Avx512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+export auto is_supported(KernelSet set) -> bool {
+#if defined(__x86_64__)
+  if (set == KernelSet::Avx512)
+    return __builtin_cpu_supports("avx512f");
+  if (set == KernelSet::Avx2)
+    return __builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma");
+#endif
+  return set == KernelSet::Scalar;
+}
+
+// From the slowest to the fastest.
+export auto supported_kernels() -> std::vector<KernelSet> {
+  auto sets = std::vector<KernelSet>{};
+  for (auto set : {KernelSet::Scalar, KernelSet::Avx2, KernelSet::Avx512}) {
+    if (is_supported(set))
+      sets.push_back(set);
+  }
+  return sets;
+}
+
+export auto fastest_kernels() -> KernelSet {
+  return supported_kernels().back();
+}
+
+}  // namespace dz
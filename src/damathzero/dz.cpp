@@ -4,8 +4,15 @@ module;
 
 export module dz;
 
+export import :alphabeta;
+export import :cpu;
 export import :game;
+export import :inference;
 export import :model;
+export import :movegen;
+export import :notation;
+export import :retrograde;
+export import :tablebase;
 
 import az;
 import std;
@@ -16,7 +23,10 @@ export using Player = az::Player;
 export using GameOutcome = az::GameOutcome;
 
 export using MCTS = az::MCTS<Game, Model>;
+export using AnalysisPool = az::AnalysisPool<Game, Model>;
 export using DamathZero = az::AlphaZero<Game, Model>;
+export using OpeningBook = az::OpeningBook<Game>;
+export using OpeningBookBuilder = az::OpeningBookBuilder<Game>;
 
 export using DeviceType = at::DeviceType;
 
@@ -34,11 +44,30 @@ export struct Application {
   struct Config {
     int32_t num_simulations = 1000;
     DeviceType device = DeviceType::CPU;
+    // Openings in this book are played instantly up to `opening_book_depth`.
+    std::optional<std::string> opening_book_path = std::nullopt;
+    int32_t opening_book_depth = 12;
+    // Evaluates positions with `InferenceEngine` instead of libtorch. Only
+    // used when the model runs on the CPU.
+    bool use_inference_engine = true;
+    // Keeps the search tree between moves, see `MCTS::Config::reuse_tree`.
+    bool reuse_tree = false;
+    // Publishes what searches found so far to `search_progress` every this
+    // many simulations, never when 0.
+    int32_t search_progress_interval = 0;
+    // When set, finished games are appended to this file as game records.
+    std::optional<std::string> game_records_path = std::nullopt;
   };
 
   Application(Config config, Model::Config model_config, std::string_view path,
               Game::State initial_state = Game::initial_state())
-      : mcts{{.num_simulations = config.num_simulations}},
+      : mcts{{.num_simulations = config.num_simulations,
+              .prune_decided_root = true,
+              .opening_book = config.opening_book_path
+                                  ? OpeningBook::load(*config.opening_book_path,
+                                                      config.opening_book_depth)
+                                  : nullptr,
+              .reuse_tree = config.reuse_tree}},
         config{config},
         model{load_model(path, model_config)},
         state{initial_state},
@@ -46,6 +75,18 @@ export struct Application {
         history{initial_state} {
     model->to(config.device);
     model->eval();
+    if (config.use_inference_engine and config.device == DeviceType::CPU)
+      engine.emplace(std::make_shared<const InferenceWeights>(*model),
+                     InferenceEngine::Config{.max_batch_size = 1});
+    if (config.search_progress_interval > 0)
+      mcts.set_observer(
+          [this](const MCTS::Progress& progress) {
+            search_progress.publish(progress);
+          },
+          config.search_progress_interval);
+    if (config.game_records_path)
+      records = std::make_unique<az::RecordWriter>(*config.game_records_path);
+    record.first_player = initial_state.player;
     update_valid_moves();
   }
 
@@ -75,13 +116,20 @@ export struct Application {
       action_map[origin_x][origin_y][new_x][new_y] = action;
     }
 
-    auto [wdl, policy] = model->forward(
-        Game::encode_state(state).unsqueeze(0).to(config.device));
+    auto [wdl, policy] = forward(Game::encode_state(state).unsqueeze(0));
 
-    if (state.player.is_first())
-      predicted_wdl = wdl.squeeze(0).to(torch::kCPU);
+    // Copied out of the tensors once, the renderer reads them every frame.
+    if (state.player.is_first()) {
+      auto probs = wdl.squeeze(0).to(torch::kCPU, torch::kFloat32);
+      predicted_wdl = {
+          {probs[0].item<float>(), probs[1].item<float>(),
+           probs[2].item<float>()}};
+    }
 
-    predicted_action_probs = policy.squeeze(0).reshape({-1}).to(torch::kCPU);
+    auto probs =
+        policy.reshape({-1}).to(torch::kCPU, torch::kFloat32).contiguous();
+    predicted_action_probs.assign(probs.data_ptr<float>(),
+                                  probs.data_ptr<float>() + probs.numel());
   }
 
   auto select_piece(int x, int y) -> void {
@@ -97,14 +145,38 @@ export struct Application {
   }
 
   auto let_ai_move() -> void {
-    auto probs = mcts.search(state, model);
+    play_ai_action(search());
+  }
+
+  // Searches on a background thread, `finish_ai_move` plays the move once the
+  // search is done. The position must not change in the meantime.
+  auto start_ai_move() -> void {
+    ai_search = std::async(std::launch::async, [this] { return search(); });
+  }
+
+  auto is_ai_thinking() const -> bool { return ai_search.valid(); }
+
+  // Plays the move of the background search if it is done.
+  auto finish_ai_move() -> void {
+    if (not is_ai_thinking() or ai_search.wait_for(std::chrono::seconds(0)) !=
+                                    std::future_status::ready)
+      return;
+
+    play_ai_action(ai_search.get());
+  }
+
+  // Plays the most visited action of a search.
+  auto play_ai_action(const torch::Tensor& probs) -> void {
     auto action = torch::argmax(probs).item<Action>();
+    record.moves.push_back(
+        {.action = action, .policy = az::sparse_policy(probs)});
     state = Game::apply_action(state, action);
     outcome = Game::get_outcome(state, action);
 
     if (outcome.has_value()) {
       outcome = outcome->flip();
       update_final_scores();
+      save_record();
     } else
       update_valid_moves();
 
@@ -114,17 +186,50 @@ export struct Application {
   auto move_piece_to(int new_x, int new_y) -> void {
     auto [x, y] = selected_piece.value();
     auto action = action_map[x][y][new_x][new_y].value();
+    record.moves.push_back({.action = action});
     state = Game::apply_action(state, action);
     outcome = Game::get_outcome(state, action);
 
-    if (outcome.has_value())
+    if (outcome.has_value()) {
       update_final_scores();
-    else
+      save_record();
+    } else
       update_valid_moves();
 
     history.push_back(state);
   }
 
+  // `outcome` is for the first player.
+  auto save_record() -> void {
+    if (not records)
+      return;
+
+    record.outcome =
+        record.first_player.is_first() ? *outcome : outcome->flip();
+    records->write(record);
+  }
+
+  // The root visit distribution of a search from the current position.
+  auto search(std::optional<int32_t> num_simulations = std::nullopt)
+      -> torch::Tensor {
+    if (not engine)
+      return mcts.search(state, model, num_simulations);
+
+    return mcts.search(
+        state,
+        [this](const torch::Tensor& features, const torch::Tensor& actions) {
+          return engine->forward_legal(features, actions);
+        },
+        num_simulations);
+  }
+
+  auto forward(const torch::Tensor& features)
+      -> std::tuple<torch::Tensor, torch::Tensor> {
+    if (engine)
+      return engine->forward(features);
+    return model->forward(features.to(config.device));
+  }
+
   auto update_final_scores() -> void {
     reset_valid_moves();
     auto& [first_player_score, second_player_score] = state.scores;
@@ -143,6 +248,8 @@ export struct Application {
   auto undo_move() -> void {
     do {
       history.pop_back();
+      if (not record.moves.empty())
+        record.moves.pop_back();
       state = history.back();
       outcome = std::nullopt;
     } while (state.player.is_second() and history.size() > 1);
@@ -153,32 +260,27 @@ export struct Application {
   auto reset_game() -> void {
     state = Game::initial_state();
     outcome = std::nullopt;
+    record = {.first_player = state.player};
 
     history.push_back(state);
     update_valid_moves();
   }
 
   auto wdl_probs() const -> std::optional<std::array<float, 3>> {
-    if (not predicted_wdl.has_value())
-      return std::nullopt;
-
-    auto wdl = predicted_wdl.value();
-    return {{wdl[0].item<float>(), wdl[1].item<float>(), wdl[2].item<float>()}};
+    return predicted_wdl;
   }
 
   auto action_probs(int i, int j) const -> float {
-    if (not predicted_action_probs.has_value() or
-        not selected_piece.has_value())
+    if (predicted_action_probs.empty() or not selected_piece.has_value())
       return 0.0f;
 
     auto [x, y] = selected_piece.value();
     auto action = action_map[x][y][i][j].value();
-    auto action_probs = predicted_action_probs.value()[action].item<float>();
-    return action_probs;
+    return predicted_action_probs[action];
   }
 
   auto max_action_probs(int i, int j) const -> float {
-    if (not predicted_action_probs.has_value())
+    if (predicted_action_probs.empty())
       return 0.0f;
 
     auto actions = action_map[i][j];
@@ -187,8 +289,7 @@ export struct Application {
       for (auto l = 0; l < 8; l++)
         if (actions[k][l].has_value()) {
           auto action = actions[k][l].value();
-          auto action_probs =
-              predicted_action_probs.value()[action].item<float>();
+          auto action_probs = predicted_action_probs[action];
           if (std::abs(action_probs) > std::abs(max_action_probs))
             max_action_probs = action_probs;
         }
@@ -200,6 +301,7 @@ export struct Application {
   Config config;
 
   std::shared_ptr<Model> model;
+  std::optional<InferenceEngine> engine;
 
   Game::State state;
   std::optional<GameOutcome> outcome;
@@ -214,8 +316,17 @@ export struct Application {
   std::optional<std::pair<int, int>> selected_piece;
   std::vector<std::pair<int, int>> next_moves[8][8];
 
-  std::optional<torch::Tensor> predicted_wdl{};
-  std::optional<torch::Tensor> predicted_action_probs{};
+  std::optional<std::array<float, 3>> predicted_wdl{};
+  // Over every action, empty until the first prediction.
+  std::vector<float> predicted_action_probs{};
+
+  std::unique_ptr<az::RecordWriter> records;
+  // The moves of the current game.
+  az::GameRecord record;
+
+  az::TripleBuffer<MCTS::Progress> search_progress;
+  // Last, so that a running search ends before what it uses is destroyed.
+  std::future<torch::Tensor> ai_search;
 };
 
 }  // namespace dz
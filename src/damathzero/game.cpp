@@ -7,6 +7,7 @@ module;
 export module dz:game;
 
 import :board;
+import :tablebase;
 
 import az;
 import std;
@@ -68,13 +69,18 @@ export struct Game {
     Position eaten_enemy_position = Position::Empty;
   };
 
-  static constexpr auto initial_state() -> State {
-    static std::mt19937 gen{std::random_device{}()};
+  static auto initial_state(std::mt19937& gen) -> State {
     return State{
         .player = gen() % 2 == 0 ? Player::First : Player::Second,
     };
   }
 
+  // Draws the first player from a generator owned by the calling thread.
+  static auto initial_state() -> State {
+    thread_local auto gen = std::mt19937{std::random_device{}()};
+    return initial_state(gen);
+  }
+
   static auto decode_action(const State& state, Action action) -> ActionInfo {
     const int8_t distance = (action / (8 * 8 * 4)) + 1;
     const int8_t direction = (action % (8 * 8 * 4)) / (8 * 8);
@@ -292,8 +298,93 @@ export struct Game {
     return legal_actions;
   }
 
+  // Implements the same rules as `legal_actions` without going through a
+  // tensor and returns the legal actions in ascending order.
+  static auto legal_action_list(const State& state) -> std::vector<Action> {
+    auto visit_pieces = [&state](auto&& visit) {
+      if (not state.eating_piece_position.is_empty()) {
+        auto [x, y] = state.eating_piece_position.value();
+        visit(x, y);
+        return;
+      }
+
+      for (int8_t y = 0; y < 8; y++) {
+        for (int8_t x = (y + 1) % 2; x < 8; x += 2) {
+          auto cell = state.board[x, y];
+          if (cell.is_occupied and cell.is_owned_by(state.player))
+            visit(x, y);
+        }
+      }
+    };
+
+    auto actions = std::vector<Action>{};
+    auto best_eats = 0;
+    auto has_dama_eat = false;
+
+    visit_pieces([&](int8_t x, int8_t y) {
+      const bool is_dama = state.board[x, y].is_knighted;
+      for (auto action : state.board.get_eatable_actions(x, y)) {
+        auto eats = get_max_eats(state, action);
+        if (eats < best_eats)
+          continue;
+
+        if (eats > best_eats) {
+          best_eats = eats;
+          has_dama_eat = false;
+          actions.clear();
+        }
+
+        // Within the longest captures, the ones made by a dama take priority.
+        if (is_dama and not has_dama_eat) {
+          has_dama_eat = true;
+          actions.clear();
+        }
+
+        if (is_dama or not has_dama_eat)
+          actions.push_back(action);
+      }
+    });
+
+    if (actions.empty()) {
+      visit_pieces([&](int8_t x, int8_t y) {
+        actions.append_range(state.board.get_jump_actions(x, y));
+      });
+    }
+
+    std::ranges::sort(actions);
+    return actions;
+  }
+
+  // Outcome for `state.player` under perfect play when the active tablebase
+  // covers the position.
+  static auto probe(const State& state) -> std::optional<az::GameOutcome> {
+    auto tablebase = active_tablebase();
+    if (tablebase == nullptr or not state.eating_piece_position.is_empty())
+      return std::nullopt;
+
+    auto margin =
+        tablebase->probe(state.board, state.player, state.draw_count);
+    if (not margin)
+      return std::nullopt;
+
+    auto [first, second] = state.scores;
+    auto score = static_cast<float32_t>(
+        state.player.is_first() ? first - second : second - first);
+
+    if (score + *margin > DrawTolerance)
+      return az::GameOutcome::Win;
+    if (score + *margin < -DrawTolerance)
+      return az::GameOutcome::Loss;
+    return az::GameOutcome::Draw;
+  }
+
   static constexpr auto get_outcome(const State& state, Action action)
       -> std::optional<az::GameOutcome> {
+    // The tablebase already decides the endgame, so the player who just moved
+    // gets the opposite of the outcome for the player to move.
+    if (auto outcome = probe(state))
+      return outcome->flip();
+
     if (legal_actions(state).nonzero().numel() > 0 and state.draw_count < 80)
       return std::nullopt;
 
@@ -401,6 +492,28 @@ export struct Game {
     return encoded_state;
   }
 
+  // Hashes everything that affects the rest of the game, used to key the
+  // opening book.
+  static auto hash(const State& state) -> uint64_t {
+    auto position_code = [](Position position) -> uint64_t {
+      return position.is_empty() ? 64 : position.y * 8 + position.x;
+    };
+
+    auto [first, second] = state.scores;
+    auto hash = az::mix(std::bit_cast<uint16_t>(first) |
+                        uint64_t{std::bit_cast<uint16_t>(second)} << 16 |
+                        uint64_t{state.draw_count} << 32 |
+                        uint64_t{state.player.is_first()} << 40 |
+                        position_code(state.eating_piece_position) << 48 |
+                        position_code(state.eating_piece_previous_position)
+                            << 56);
+
+    auto words = std::bit_cast<std::array<uint64_t, 8>>(state.board.cells);
+    for (auto word : words)
+      hash = az::mix(hash ^ word);
+    return hash;
+  }
+
   static auto print(const State&) -> void {}
 };
 
@@ -0,0 +1,948 @@
+module;
+
+#include <torch/torch.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <cassert>
+
+export module dz:inference;
+
+import :cpu;
+import :model;
+
+import az;
+import std;
+
+namespace dz {
+
+namespace kernels {
+
+// y[rows, out] = x[rows, in] * w[in, out] + bias, added to y instead of
+// overwriting it when `accumulate` is set. Every matrix is row major with the
+// given leading dimension and `bias` may be null.
+struct Gemm {
+  int64_t rows;
+  int64_t in;
+  int64_t out;
+  const float* x;
+  int64_t ldx;
+  const float* w;
+  int64_t ldw;
+  const float* bias;
+  float* y;
+  int64_t ldy;
+  bool accumulate = false;
+};
+
+// The kernels that have a vectorized version, the rest of the forward pass is
+// cheap enough to stay scalar.
+struct Table {
+  KernelSet set;
+  auto (*gemm)(const Gemm&) -> void;
+  // The dot product of two vectors of `n` values.
+  auto (*dot)(const float*, const float*, int64_t) -> float;
+  // In place over `n` values.
+  auto (*exp)(float*, int64_t) -> void;
+  auto (*gelu)(float*, int64_t) -> void;
+};
+
+// The constants of Cephes' expf and of the erf approximation 7.1.26 of
+// Abramowitz and Stegun, whose absolute error is below 1.5e-7.
+constexpr auto ExpMax = 88.3762626647949f;
+constexpr auto Log2E = 1.44269504088896341f;
+constexpr auto Ln2High = 0.693359375f;
+constexpr auto Ln2Low = -2.12194440e-4f;
+constexpr auto ExpPolynomial = std::array{
+    1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+    4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f,
+};
+constexpr auto ErfP = 0.3275911f;
+constexpr auto ErfPolynomial = std::array{
+    1.061405429f, -1.453152027f, 1.421413741f, -0.284496736f, 0.254829592f,
+};
+constexpr auto InverseSqrt2 = 0.70710678118654752f;
+
+namespace scalar {
+
+auto gemm(const Gemm& g) -> void {
+  for (auto row : std::views::iota(int64_t{0}, g.rows)) {
+    auto* y = g.y + row * g.ldy;
+    for (auto col : std::views::iota(int64_t{0}, g.out)) {
+      auto initial = g.bias ? g.bias[col] : 0.0f;
+      y[col] = g.accumulate ? y[col] + initial : initial;
+    }
+
+    for (auto k : std::views::iota(int64_t{0}, g.in)) {
+      auto a = g.x[row * g.ldx + k];
+      auto* w = g.w + k * g.ldw;
+      for (auto col : std::views::iota(int64_t{0}, g.out))
+        y[col] += a * w[col];
+    }
+  }
+}
+
+auto dot(const float* a, const float* b, int64_t n) -> float {
+  auto sum = 0.0f;
+  for (auto i : std::views::iota(int64_t{0}, n))
+    sum += a[i] * b[i];
+  return sum;
+}
+
+auto exp(float* data, int64_t n) -> void {
+  for (auto i : std::views::iota(int64_t{0}, n))
+    data[i] = std::exp(data[i]);
+}
+
+auto gelu(float* data, int64_t n) -> void {
+  for (auto i : std::views::iota(int64_t{0}, n))
+    data[i] = 0.5f * data[i] * (1.0f + std::erf(data[i] * InverseSqrt2));
+}
+
+constexpr auto table = Table{KernelSet::Scalar, gemm, dot, exp, gelu};
+
+}  // namespace scalar
+
+#if defined(__x86_64__)
+
+namespace avx2 {
+
+constexpr auto W = int64_t{8};
+
+[[gnu::target("avx2,fma"), gnu::always_inline]] inline auto tail_mask(
+    int64_t n) -> __m256i {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int32_t>(n)),
+                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+[[gnu::target("avx2,fma"), gnu::always_inline]] inline auto exp(__m256 x)
+    -> __m256 {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-ExpMax)),
+                    _mm256_set1_ps(ExpMax));
+
+  // x = n ln(2) + r with |r| <= ln(2) / 2.
+  auto n = _mm256_floor_ps(
+      _mm256_fmadd_ps(x, _mm256_set1_ps(Log2E), _mm256_set1_ps(0.5f)));
+  x = _mm256_fnmadd_ps(n, _mm256_set1_ps(Ln2High), x);
+  x = _mm256_fnmadd_ps(n, _mm256_set1_ps(Ln2Low), x);
+
+  auto y = _mm256_set1_ps(ExpPolynomial[0]);
+  for (auto c : ExpPolynomial | std::views::drop(1))
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(c));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x),
+                      _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+  auto exponent = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+}
+
+[[gnu::target("avx2,fma"), gnu::always_inline]] inline auto gelu(__m256 x)
+    -> __m256 {
+  auto z = _mm256_mul_ps(x, _mm256_set1_ps(InverseSqrt2));
+  auto sign = _mm256_and_ps(z, _mm256_set1_ps(-0.0f));
+  auto abs = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), z);
+
+  auto t = _mm256_div_ps(
+      _mm256_set1_ps(1.0f),
+      _mm256_fmadd_ps(abs, _mm256_set1_ps(ErfP), _mm256_set1_ps(1.0f)));
+  auto p = _mm256_set1_ps(ErfPolynomial[0]);
+  for (auto c : ErfPolynomial | std::views::drop(1))
+    p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(c));
+  p = _mm256_mul_ps(p, t);
+
+  auto erf = _mm256_fnmadd_ps(
+      p, exp(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(abs, abs))),
+      _mm256_set1_ps(1.0f));
+  erf = _mm256_or_ps(erf, sign);
+
+  return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), x),
+                       _mm256_add_ps(_mm256_set1_ps(1.0f), erf));
+}
+
+// `R` rows at once, so that every weight loaded is used `R` times.
+template <int64_t R>
+[[gnu::target("avx2,fma")]] auto gemm_rows(const Gemm& g, int64_t row)
+    -> void {
+  auto col = int64_t{0};
+  for (; col + 2 * W <= g.out; col += 2 * W) {
+    __m256 acc[R][2];
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++) {
+#pragma GCC unroll 2
+      for (auto v = int64_t{0}; v < 2; v++) {
+        auto offset = col + v * W;
+        acc[r][v] = g.bias ? _mm256_loadu_ps(g.bias + offset)
+                           : _mm256_setzero_ps();
+        if (g.accumulate)
+          acc[r][v] = _mm256_add_ps(
+              acc[r][v], _mm256_loadu_ps(g.y + (row + r) * g.ldy + offset));
+      }
+    }
+
+    for (auto k = int64_t{0}; k < g.in; k++) {
+      auto b0 = _mm256_loadu_ps(g.w + k * g.ldw + col);
+      auto b1 = _mm256_loadu_ps(g.w + k * g.ldw + col + W);
+#pragma GCC unroll 4
+      for (auto r = int64_t{0}; r < R; r++) {
+        auto a = _mm256_broadcast_ss(g.x + (row + r) * g.ldx + k);
+        acc[r][0] = _mm256_fmadd_ps(a, b0, acc[r][0]);
+        acc[r][1] = _mm256_fmadd_ps(a, b1, acc[r][1]);
+      }
+    }
+
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++) {
+      _mm256_storeu_ps(g.y + (row + r) * g.ldy + col, acc[r][0]);
+      _mm256_storeu_ps(g.y + (row + r) * g.ldy + col + W, acc[r][1]);
+    }
+  }
+
+  // The last columns one masked vector at a time.
+  for (; col < g.out; col += W) {
+    auto mask = tail_mask(g.out - col);
+    __m256 acc[R];
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++) {
+      acc[r] = g.bias ? _mm256_maskload_ps(g.bias + col, mask)
+                      : _mm256_setzero_ps();
+      if (g.accumulate)
+        acc[r] = _mm256_add_ps(
+            acc[r], _mm256_maskload_ps(g.y + (row + r) * g.ldy + col, mask));
+    }
+
+    for (auto k = int64_t{0}; k < g.in; k++) {
+      auto b = _mm256_maskload_ps(g.w + k * g.ldw + col, mask);
+#pragma GCC unroll 4
+      for (auto r = int64_t{0}; r < R; r++) {
+        auto a = _mm256_broadcast_ss(g.x + (row + r) * g.ldx + k);
+        acc[r] = _mm256_fmadd_ps(a, b, acc[r]);
+      }
+    }
+
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++)
+      _mm256_maskstore_ps(g.y + (row + r) * g.ldy + col, mask, acc[r]);
+  }
+}
+
+[[gnu::target("avx2,fma")]] auto gemm(const Gemm& g) -> void {
+  auto row = int64_t{0};
+  for (; row + 4 <= g.rows; row += 4)
+    gemm_rows<4>(g, row);
+  for (; row < g.rows; row++)
+    gemm_rows<1>(g, row);
+}
+
+[[gnu::target("avx2,fma")]] auto dot(const float* a, const float* b,
+                                     int64_t n) -> float {
+  auto acc0 = _mm256_setzero_ps();
+  auto acc1 = _mm256_setzero_ps();
+  auto i = int64_t{0};
+  for (; i + 2 * W <= n; i += 2 * W) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),
+                           acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + W),
+                           _mm256_loadu_ps(b + i + W), acc1);
+  }
+  for (; i < n; i += W) {
+    auto mask = tail_mask(n - i);
+    acc0 = _mm256_fmadd_ps(_mm256_maskload_ps(a + i, mask),
+                           _mm256_maskload_ps(b + i, mask), acc0);
+  }
+
+  auto sum = _mm256_add_ps(acc0, acc1);
+  auto half = _mm_add_ps(_mm256_castps256_ps128(sum),
+                         _mm256_extractf128_ps(sum, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_movehdup_ps(half));
+  return _mm_cvtss_f32(half);
+}
+
+[[gnu::target("avx2,fma")]] auto exp(float* data, int64_t n) -> void {
+  for (auto i = int64_t{0}; i < n; i += W) {
+    auto mask = tail_mask(n - i);
+    _mm256_maskstore_ps(data + i, mask,
+                        exp(_mm256_maskload_ps(data + i, mask)));
+  }
+}
+
+[[gnu::target("avx2,fma")]] auto gelu(float* data, int64_t n) -> void {
+  for (auto i = int64_t{0}; i < n; i += W) {
+    auto mask = tail_mask(n - i);
+    _mm256_maskstore_ps(data + i, mask,
+                        gelu(_mm256_maskload_ps(data + i, mask)));
+  }
+}
+
+constexpr auto table = Table{KernelSet::Avx2, gemm, dot, exp, gelu};
+
+}  // namespace avx2
+
+namespace avx512 {
+
+constexpr auto W = int64_t{16};
+// Exp uses the zero masked forms of the intrinsics that GCC's headers
+// implement with an undefined source, which trips -Wmaybe-uninitialized.
+constexpr auto All = __mmask16(0xffff);
+
+[[gnu::target("avx512f"), gnu::always_inline]] inline auto tail_mask(
+    int64_t n) -> __mmask16 {
+  return n >= W ? All : __mmask16((1u << n) - 1);
+}
+
+[[gnu::target("avx512f"), gnu::always_inline]] inline auto exp(__m512 x)
+    -> __m512 {
+  x = _mm512_maskz_min_ps(
+      All, _mm512_maskz_max_ps(All, x, _mm512_set1_ps(-ExpMax)),
+      _mm512_set1_ps(ExpMax));
+
+  auto n = _mm512_maskz_roundscale_ps(
+      All, _mm512_fmadd_ps(x, _mm512_set1_ps(Log2E), _mm512_set1_ps(0.5f)),
+      _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  x = _mm512_fnmadd_ps(n, _mm512_set1_ps(Ln2High), x);
+  x = _mm512_fnmadd_ps(n, _mm512_set1_ps(Ln2Low), x);
+
+  auto y = _mm512_set1_ps(ExpPolynomial[0]);
+  for (auto c : ExpPolynomial | std::views::drop(1))
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(c));
+  y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x),
+                      _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+
+  // Scales by 2^n without building the exponent bits by hand.
+  return _mm512_maskz_scalef_ps(All, y, n);
+}
+
+[[gnu::target("avx512f"), gnu::always_inline]] inline auto gelu(__m512 x)
+    -> __m512 {
+  auto z = _mm512_mul_ps(x, _mm512_set1_ps(InverseSqrt2));
+  auto abs = _mm512_abs_ps(z);
+
+  auto t = _mm512_div_ps(
+      _mm512_set1_ps(1.0f),
+      _mm512_fmadd_ps(abs, _mm512_set1_ps(ErfP), _mm512_set1_ps(1.0f)));
+  auto p = _mm512_set1_ps(ErfPolynomial[0]);
+  for (auto c : ErfPolynomial | std::views::drop(1))
+    p = _mm512_fmadd_ps(p, t, _mm512_set1_ps(c));
+  p = _mm512_mul_ps(p, t);
+
+  auto erf = _mm512_fnmadd_ps(
+      p, exp(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_mul_ps(abs, abs))),
+      _mm512_set1_ps(1.0f));
+  // erf is odd.
+  erf = _mm512_mask_sub_ps(erf, _mm512_cmp_ps_mask(z, _mm512_setzero_ps(),
+                                                   _CMP_LT_OQ),
+                           _mm512_setzero_ps(), erf);
+
+  return _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), x),
+                       _mm512_add_ps(_mm512_set1_ps(1.0f), erf));
+}
+
+template <int64_t R>
+[[gnu::target("avx512f")]] auto gemm_rows(const Gemm& g, int64_t row)
+    -> void {
+  auto col = int64_t{0};
+  for (; col + 2 * W <= g.out; col += 2 * W) {
+    __m512 acc[R][2];
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++) {
+#pragma GCC unroll 2
+      for (auto v = int64_t{0}; v < 2; v++) {
+        auto offset = col + v * W;
+        acc[r][v] = g.bias ? _mm512_loadu_ps(g.bias + offset)
+                           : _mm512_setzero_ps();
+        if (g.accumulate)
+          acc[r][v] = _mm512_add_ps(
+              acc[r][v], _mm512_loadu_ps(g.y + (row + r) * g.ldy + offset));
+      }
+    }
+
+    for (auto k = int64_t{0}; k < g.in; k++) {
+      auto b0 = _mm512_loadu_ps(g.w + k * g.ldw + col);
+      auto b1 = _mm512_loadu_ps(g.w + k * g.ldw + col + W);
+#pragma GCC unroll 4
+      for (auto r = int64_t{0}; r < R; r++) {
+        auto a = _mm512_set1_ps(g.x[(row + r) * g.ldx + k]);
+        acc[r][0] = _mm512_fmadd_ps(a, b0, acc[r][0]);
+        acc[r][1] = _mm512_fmadd_ps(a, b1, acc[r][1]);
+      }
+    }
+
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++) {
+      _mm512_storeu_ps(g.y + (row + r) * g.ldy + col, acc[r][0]);
+      _mm512_storeu_ps(g.y + (row + r) * g.ldy + col + W, acc[r][1]);
+    }
+  }
+
+  for (; col < g.out; col += W) {
+    auto mask = tail_mask(g.out - col);
+    __m512 acc[R];
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++) {
+      acc[r] = g.bias ? _mm512_maskz_loadu_ps(mask, g.bias + col)
+                      : _mm512_setzero_ps();
+      if (g.accumulate)
+        acc[r] = _mm512_add_ps(
+            acc[r],
+            _mm512_maskz_loadu_ps(mask, g.y + (row + r) * g.ldy + col));
+    }
+
+    for (auto k = int64_t{0}; k < g.in; k++) {
+      auto b = _mm512_maskz_loadu_ps(mask, g.w + k * g.ldw + col);
+#pragma GCC unroll 4
+      for (auto r = int64_t{0}; r < R; r++) {
+        auto a = _mm512_set1_ps(g.x[(row + r) * g.ldx + k]);
+        acc[r] = _mm512_fmadd_ps(a, b, acc[r]);
+      }
+    }
+
+#pragma GCC unroll 4
+    for (auto r = int64_t{0}; r < R; r++)
+      _mm512_mask_storeu_ps(g.y + (row + r) * g.ldy + col, mask, acc[r]);
+  }
+}
+
+[[gnu::target("avx512f")]] auto gemm(const Gemm& g) -> void {
+  auto row = int64_t{0};
+  for (; row + 4 <= g.rows; row += 4)
+    gemm_rows<4>(g, row);
+  for (; row < g.rows; row++)
+    gemm_rows<1>(g, row);
+}
+
+[[gnu::target("avx512f")]] auto dot(const float* a, const float* b,
+                                   int64_t n) -> float {
+  auto acc0 = _mm512_setzero_ps();
+  auto acc1 = _mm512_setzero_ps();
+  auto i = int64_t{0};
+  for (; i + 2 * W <= n; i += 2 * W) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i),
+                           acc0);
+    acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + W),
+                           _mm512_loadu_ps(b + i + W), acc1);
+  }
+  for (; i < n; i += W) {
+    auto mask = tail_mask(n - i);
+    acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                           _mm512_maskz_loadu_ps(mask, b + i), acc0);
+  }
+
+  // Not _mm512_reduce_add_ps, for the same reason as `All`.
+  alignas(64) float lanes[W];
+  _mm512_store_ps(lanes, _mm512_add_ps(acc0, acc1));
+  return std::accumulate(std::begin(lanes), std::end(lanes), 0.0f);
+}
+
+[[gnu::target("avx512f")]] auto exp(float* data, int64_t n) -> void {
+  for (auto i = int64_t{0}; i < n; i += W) {
+    auto mask = tail_mask(n - i);
+    _mm512_mask_storeu_ps(data + i, mask,
+                          exp(_mm512_maskz_loadu_ps(mask, data + i)));
+  }
+}
+
+[[gnu::target("avx512f")]] auto gelu(float* data, int64_t n) -> void {
+  for (auto i = int64_t{0}; i < n; i += W) {
+    auto mask = tail_mask(n - i);
+    _mm512_mask_storeu_ps(data + i, mask,
+                          gelu(_mm512_maskz_loadu_ps(mask, data + i)));
+  }
+}
+
+constexpr auto table = Table{KernelSet::Avx512, gemm, dot, exp, gelu};
+
+}  // namespace avx512
+
+#endif
+
+auto table(KernelSet set) -> const Table& {
+  if (not is_supported(set))
+    throw std::runtime_error(
+        std::format("The CPU does not support {} kernels.", to_string(set)));
+#if defined(__x86_64__)
+  if (set == KernelSet::Avx512)
+    return avx512::table;
+  if (set == KernelSet::Avx2)
+    return avx2::table;
+#endif
+  return scalar::table;
+}
+
+}  // namespace kernels
+
+// The parameters of a `Model` copied out of libtorch in the layouts the
+// kernels read. Linear weights are transposed to (in, out) and the query
+// projection is scaled by the attention's 1 / sqrt(head_dim) in advance.
+export class InferenceWeights {
+ public:
+  struct LayerNorm {
+    std::vector<float> weight;
+    std::vector<float> bias;
+  };
+
+  struct Linear {
+    std::vector<float> weight;
+    std::vector<float> bias;
+  };
+
+  struct Block {
+    LayerNorm layer_norm1;
+    Linear in_projection;
+    Linear out_projection;
+    LayerNorm layer_norm2;
+    Linear layer1;
+    Linear layer2;
+  };
+
+  explicit InferenceWeights(Model& model) {
+    torch::NoGradGuard no_grad;
+
+    auto& config = model.config;
+    embedding_dim = config.embedding_dim;
+    num_heads = config.num_attention_head;
+    mlp_hidden_size = config.mlp_hidden_size;
+    action_size = config.action_size;
+
+    auto& embedding = *model.embedding;
+    num_cls_tokens = embedding.cls_tokens.size(1);
+    num_tokens = embedding.positional_embedding.size(1);
+    feature_width = embedding.projection->weight.size(1);
+
+    projection = linear(embedding.projection);
+    cls_tokens = copy(embedding.cls_tokens);
+    positional_embedding = copy(embedding.positional_embedding);
+    embedding_norm = layer_norm(embedding.layer_norm);
+
+    auto scale = 1.0f / std::sqrt(static_cast<float>(head_dim()));
+    for (auto& module : *model.encoder->blocks) {
+      auto& block = *module->as<dz::Block>();
+      auto& attention = *block.attention;
+
+      auto in_projection = Linear{
+          .weight = transpose(attention.in_proj_weight),
+          .bias = copy(attention.in_proj_bias),
+      };
+      auto size = 3 * embedding_dim;
+      for (auto k : std::views::iota(int64_t{0}, embedding_dim)) {
+        for (auto n : std::views::iota(int64_t{0}, embedding_dim))
+          in_projection.weight[k * size + n] *= scale;
+      }
+      for (auto n : std::views::iota(int64_t{0}, embedding_dim))
+        in_projection.bias[n] *= scale;
+
+      blocks.push_back({
+          .layer_norm1 = layer_norm(block.layer_norm1),
+          .in_projection = std::move(in_projection),
+          .out_projection = linear(attention.out_proj),
+          .layer_norm2 = layer_norm(block.layer_norm2),
+          .layer1 = linear(block.mlp->layer1),
+          .layer2 = linear(block.mlp->layer2),
+      });
+    }
+
+    encoder_norm = layer_norm(model.encoder->layer_norm);
+    wdl_head = linear(model.wdl_head);
+    policy_head = linear(model.policy_head);
+    policy_rows = copy(model.policy_head->weight);
+  }
+
+  static auto load(std::string_view path, Model::Config config)
+      -> std::shared_ptr<const InferenceWeights> {
+    auto model = az::utils::load_model<Model>(path, config);
+    return std::make_shared<const InferenceWeights>(*model);
+  }
+
+  auto head_dim() const -> int64_t { return embedding_dim / num_heads; }
+
+  int64_t embedding_dim;
+  int64_t num_heads;
+  int64_t mlp_hidden_size;
+  int64_t action_size;
+  int64_t num_cls_tokens;
+  int64_t num_tokens;
+  int64_t feature_width;
+
+  Linear projection;
+  std::vector<float> cls_tokens;
+  std::vector<float> positional_embedding;
+  LayerNorm embedding_norm;
+
+  std::vector<Block> blocks;
+
+  LayerNorm encoder_norm;
+  Linear wdl_head;
+  Linear policy_head;
+  // The policy head as (out, in) as well, where the weights of an action are
+  // contiguous.
+  std::vector<float> policy_rows;
+
+ private:
+  static auto copy(const torch::Tensor& tensor) -> std::vector<float> {
+    auto contiguous = tensor.to(torch::kCPU, torch::kFloat32).contiguous();
+    auto data = contiguous.data_ptr<float>();
+    return {data, data + contiguous.numel()};
+  }
+
+  static auto transpose(const torch::Tensor& weight) -> std::vector<float> {
+    return copy(weight.t());
+  }
+
+  static auto linear(const torch::nn::Linear& linear) -> Linear {
+    return {.weight = transpose(linear->weight), .bias = copy(linear->bias)};
+  }
+
+  static auto layer_norm(const torch::nn::LayerNorm& layer_norm)
+      -> LayerNorm {
+    return {.weight = copy(layer_norm->weight),
+            .bias = copy(layer_norm->bias)};
+  }
+};
+
+// Runs the forward pass of `Model` in evaluation mode with hand-written
+// kernels, picked at construction from the features of the CPU. At the batch
+// sizes of a search libtorch spends most of its time dispatching operators,
+// which this avoids. The activations are allocated once for
+// `max_batch_size` positions, so `run` never allocates. An engine is not
+// thread safe, but any number of engines can share the same weights.
+export class InferenceEngine {
+ public:
+  using Output = std::tuple<torch::Tensor, torch::Tensor>;
+
+  struct Config {
+    int32_t max_batch_size = 32;
+    // The fastest set the CPU supports when not set.
+    std::optional<KernelSet> kernels = std::nullopt;
+  };
+
+  InferenceEngine(std::shared_ptr<const InferenceWeights> weights,
+                  Config config = {})
+      : weights_(std::move(weights)),
+        max_batch_size_(config.max_batch_size),
+        kernels_(&kernels::table(config.kernels.value_or(fastest_kernels()))) {
+    auto& w = *weights_;
+    auto rows = max_batch_size_ * w.num_tokens;
+    x_.resize(rows * w.embedding_dim);
+    qkv_.resize(rows * 3 * w.embedding_dim);
+    attention_.resize(rows * w.embedding_dim);
+    hidden_.resize(rows * w.mlp_hidden_size);
+    keys_.resize(w.head_dim() * w.num_tokens);
+    scores_.resize(w.num_tokens * w.num_tokens);
+    wdl_.resize(max_batch_size_ * 3);
+    policy_.resize(max_batch_size_ * w.action_size);
+  }
+
+  auto kernels() const -> KernelSet { return kernels_->set; }
+
+  // Evaluates `batch_size` encoded states laid out as `Game::encode_state`
+  // does. The results stay in `wdl` and `policy` until the next call.
+  auto run(std::span<const float> features, int64_t batch_size) -> void {
+    auto& w = *weights_;
+    encode(features, batch_size);
+
+    policy_width_ = w.action_size;
+    kernels_->gemm({.rows = batch_size,
+                    .in = w.num_cls_tokens * w.embedding_dim,
+                    .out = w.action_size,
+                    .x = x_.data(),
+                    .ldx = w.num_tokens * w.embedding_dim,
+                    .w = w.policy_head.weight.data(),
+                    .ldw = w.action_size,
+                    .bias = w.policy_head.bias.data(),
+                    .y = policy_.data(),
+                    .ldy = w.action_size});
+  }
+
+  // Same as `run` with the policy as the softmax over `actions` only, the
+  // indices of the legal actions of every position padded with -1 to
+  // `num_actions`, as `Model::forward_legal` takes them. Each action costs one
+  // dot product instead of a column of the whole policy head.
+  auto run_legal(std::span<const float> features,
+                 std::span<const int64_t> actions, int64_t num_actions,
+                 int64_t batch_size) -> void {
+    auto& w = *weights_;
+    assert(num_actions <= w.action_size);
+    assert(std::ssize(actions) == batch_size * num_actions);
+    encode(features, batch_size);
+
+    auto size = w.num_cls_tokens * w.embedding_dim;
+    policy_width_ = num_actions;
+    for (auto b : std::views::iota(int64_t{0}, batch_size)) {
+      auto* x = x_.data() + b * w.num_tokens * w.embedding_dim;
+      auto* legal = actions.data() + b * num_actions;
+      auto* policy = policy_.data() + b * num_actions;
+
+      auto count = int64_t{0};
+      for (; count < num_actions and legal[count] >= 0; count++) {
+        auto action = legal[count];
+        policy[count] =
+            kernels_->dot(x, w.policy_rows.data() + action * size, size) +
+            w.policy_head.bias[action];
+      }
+      softmax(policy, count);
+      std::fill(policy + count, policy + num_actions, 0.0f);
+    }
+  }
+
+  // Win, draw and loss probabilities of every position of the last run.
+  auto wdl(int64_t batch_size) const -> std::span<const float> {
+    return {wdl_.data(), static_cast<size_t>(batch_size * 3)};
+  }
+
+  // Policy logits of every position of the last `run`, or the policy over
+  // the actions of the last `run_legal`.
+  auto policy(int64_t batch_size) const -> std::span<const float> {
+    return {policy_.data(), static_cast<size_t>(batch_size * policy_width_)};
+  }
+
+  // Same contract as `Model::forward`, so the engine can stand in for the
+  // model. Batches larger than `max_batch_size` are split, and only the
+  // returned tensors are allocated.
+  auto forward(const torch::Tensor& features) -> Output {
+    auto contiguous = features.to(torch::kCPU, torch::kFloat32).contiguous();
+    auto batch_size = contiguous.size(0);
+    auto position_size = contiguous.numel() / std::max<int64_t>(batch_size, 1);
+
+    auto wdl = torch::empty({batch_size, 3}, torch::kFloat32);
+    auto policy =
+        torch::empty({batch_size, weights_->action_size}, torch::kFloat32);
+
+    for (auto start = int64_t{0}; start < batch_size;
+         start += max_batch_size_) {
+      auto size = std::min<int64_t>(max_batch_size_, batch_size - start);
+      run(std::span(contiguous.data_ptr<float>() + start * position_size,
+                    size * position_size),
+          size);
+      std::ranges::copy(this->wdl(size), wdl.data_ptr<float>() + start * 3);
+      std::ranges::copy(this->policy(size), policy.data_ptr<float>() +
+                                                start * weights_->action_size);
+    }
+
+    return {wdl, policy};
+  }
+
+  // Same contract as `Model::forward_legal`.
+  auto forward_legal(const torch::Tensor& features,
+                     const torch::Tensor& actions) -> Output {
+    auto contiguous = features.to(torch::kCPU, torch::kFloat32).contiguous();
+    auto legal = actions.to(torch::kCPU, torch::kInt64).contiguous();
+    auto batch_size = contiguous.size(0);
+    auto num_actions = legal.size(1);
+    auto position_size = contiguous.numel() / std::max<int64_t>(batch_size, 1);
+
+    auto wdl = torch::empty({batch_size, 3}, torch::kFloat32);
+    auto policy = torch::empty({batch_size, num_actions}, torch::kFloat32);
+
+    for (auto start = int64_t{0}; start < batch_size;
+         start += max_batch_size_) {
+      auto size = std::min<int64_t>(max_batch_size_, batch_size - start);
+      run_legal(std::span(contiguous.data_ptr<float>() + start * position_size,
+                          size * position_size),
+                std::span(legal.data_ptr<int64_t>() + start * num_actions,
+                          size * num_actions),
+                num_actions, size);
+      std::ranges::copy(this->wdl(size), wdl.data_ptr<float>() + start * 3);
+      std::ranges::copy(this->policy(size),
+                        policy.data_ptr<float>() + start * num_actions);
+    }
+
+    return {wdl, policy};
+  }
+
+ private:
+  // The forward pass up to the policy head. Leaves the normalized class
+  // tokens of every position in `x_` and the finished value in `wdl_`.
+  auto encode(std::span<const float> features, int64_t batch_size) -> void {
+    auto& w = *weights_;
+    assert(batch_size <= max_batch_size_);
+    assert(std::ssize(features) ==
+           batch_size * (w.num_tokens - w.num_cls_tokens) * w.feature_width);
+
+    auto E = w.embedding_dim;
+    auto T = w.num_tokens;
+    auto C = w.num_cls_tokens;
+    auto rows = batch_size * T;
+
+    // The class tokens, then the projected features, plus the positions.
+    for (auto b : std::views::iota(int64_t{0}, batch_size)) {
+      auto* x = x_.data() + b * T * E;
+      std::ranges::copy(w.cls_tokens, x);
+      kernels_->gemm({.rows = T - C,
+                      .in = w.feature_width,
+                      .out = E,
+                      .x = features.data() + b * (T - C) * w.feature_width,
+                      .ldx = w.feature_width,
+                      .w = w.projection.weight.data(),
+                      .ldw = E,
+                      .bias = w.projection.bias.data(),
+                      .y = x + C * E,
+                      .ldy = E});
+      for (auto i : std::views::iota(int64_t{0}, T * E))
+        x[i] += w.positional_embedding[i];
+    }
+    layer_norm(x_.data(), rows, E, w.embedding_norm);
+
+    for (auto& block : w.blocks) {
+      layer_norm(x_.data(), rows, E, block.layer_norm1);
+      kernels_->gemm({.rows = rows,
+                      .in = E,
+                      .out = 3 * E,
+                      .x = x_.data(),
+                      .ldx = E,
+                      .w = block.in_projection.weight.data(),
+                      .ldw = 3 * E,
+                      .bias = block.in_projection.bias.data(),
+                      .y = qkv_.data(),
+                      .ldy = 3 * E});
+      attend(batch_size);
+      // The residual is added to the normalized input, as in `Block`.
+      kernels_->gemm({.rows = rows,
+                      .in = E,
+                      .out = E,
+                      .x = attention_.data(),
+                      .ldx = E,
+                      .w = block.out_projection.weight.data(),
+                      .ldw = E,
+                      .bias = block.out_projection.bias.data(),
+                      .y = x_.data(),
+                      .ldy = E,
+                      .accumulate = true});
+
+      layer_norm(x_.data(), rows, E, block.layer_norm2);
+      kernels_->gemm({.rows = rows,
+                      .in = E,
+                      .out = w.mlp_hidden_size,
+                      .x = x_.data(),
+                      .ldx = E,
+                      .w = block.layer1.weight.data(),
+                      .ldw = w.mlp_hidden_size,
+                      .bias = block.layer1.bias.data(),
+                      .y = hidden_.data(),
+                      .ldy = w.mlp_hidden_size});
+      kernels_->gelu(hidden_.data(), rows * w.mlp_hidden_size);
+      kernels_->gemm({.rows = rows,
+                      .in = w.mlp_hidden_size,
+                      .out = E,
+                      .x = hidden_.data(),
+                      .ldx = w.mlp_hidden_size,
+                      .w = block.layer2.weight.data(),
+                      .ldw = E,
+                      .bias = block.layer2.bias.data(),
+                      .y = x_.data(),
+                      .ldy = E,
+                      .accumulate = true});
+    }
+
+    // Only the class tokens reach the heads, flattened they are contiguous.
+    for (auto b : std::views::iota(int64_t{0}, batch_size))
+      layer_norm(x_.data() + b * T * E, C, E, w.encoder_norm);
+
+    kernels_->gemm({.rows = batch_size,
+                    .in = C * E,
+                    .out = 3,
+                    .x = x_.data(),
+                    .ldx = T * E,
+                    .w = w.wdl_head.weight.data(),
+                    .ldw = 3,
+                    .bias = w.wdl_head.bias.data(),
+                    .y = wdl_.data(),
+                    .ldy = 3});
+    for (auto b : std::views::iota(int64_t{0}, batch_size))
+      softmax(wdl_.data() + b * 3, 3);
+  }
+
+  // Multi-head self-attention of every position from `qkv_` into
+  // `attention_`, with the heads concatenated.
+  auto attend(int64_t batch_size) -> void {
+    auto& w = *weights_;
+    auto E = w.embedding_dim;
+    auto T = w.num_tokens;
+    auto D = w.head_dim();
+
+    for (auto b : std::views::iota(int64_t{0}, batch_size)) {
+      auto* qkv = qkv_.data() + b * T * 3 * E;
+      for (auto h : std::views::iota(int64_t{0}, w.num_heads)) {
+        // The keys of the head transposed to (head_dim, tokens).
+        for (auto t : std::views::iota(int64_t{0}, T)) {
+          for (auto d : std::views::iota(int64_t{0}, D))
+            keys_[d * T + t] = qkv[t * 3 * E + E + h * D + d];
+        }
+
+        kernels_->gemm({.rows = T,
+                        .in = D,
+                        .out = T,
+                        .x = qkv + h * D,
+                        .ldx = 3 * E,
+                        .w = keys_.data(),
+                        .ldw = T,
+                        .bias = nullptr,
+                        .y = scores_.data(),
+                        .ldy = T});
+        for (auto t : std::views::iota(int64_t{0}, T))
+          softmax(scores_.data() + t * T, T);
+
+        kernels_->gemm({.rows = T,
+                        .in = T,
+                        .out = D,
+                        .x = scores_.data(),
+                        .ldx = T,
+                        .w = qkv + 2 * E + h * D,
+                        .ldw = 3 * E,
+                        .bias = nullptr,
+                        .y = attention_.data() + b * T * E + h * D,
+                        .ldy = E});
+      }
+    }
+  }
+
+  auto softmax(float* data, int64_t n) -> void {
+    if (n == 0)
+      return;
+
+    auto max = *std::max_element(data, data + n);
+    for (auto i : std::views::iota(int64_t{0}, n))
+      data[i] -= max;
+    kernels_->exp(data, n);
+
+    auto sum = std::accumulate(data, data + n, 0.0f);
+    for (auto i : std::views::iota(int64_t{0}, n))
+      data[i] /= sum;
+  }
+
+  // In place over `rows` rows of `size` values, with libtorch's epsilon.
+  static auto layer_norm(float* data, int64_t rows, int64_t size,
+                         const InferenceWeights::LayerNorm& norm) -> void {
+    constexpr auto Epsilon = 1e-5f;
+    for (auto row : std::views::iota(int64_t{0}, rows)) {
+      auto* x = data + row * size;
+      auto mean = std::accumulate(x, x + size, 0.0f) / size;
+      auto variance = 0.0f;
+      for (auto i : std::views::iota(int64_t{0}, size))
+        variance += (x[i] - mean) * (x[i] - mean);
+      variance /= size;
+
+      auto inverse = 1.0f / std::sqrt(variance + Epsilon);
+      for (auto i : std::views::iota(int64_t{0}, size))
+        x[i] = (x[i] - mean) * inverse * norm.weight[i] + norm.bias[i];
+    }
+  }
+
+  std::shared_ptr<const InferenceWeights> weights_;
+  int64_t max_batch_size_;
+  const kernels::Table* kernels_;
+
+  std::vector<float> x_;
+  std::vector<float> qkv_;
+  std::vector<float> attention_;
+  std::vector<float> hidden_;
+  std::vector<float> keys_;
+  std::vector<float> scores_;
+  std::vector<float> wdl_;
+  std::vector<float> policy_;
+  // Values per position in `policy_`.
+  int64_t policy_width_ = 0;
+};
+
+}  // namespace dz
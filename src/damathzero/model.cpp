@@ -4,6 +4,8 @@ module;
 
 export module dz:model;
 
+import :game;
+
 import az;
 import std;
 
@@ -169,13 +171,14 @@ struct Encoder : public nn::Module {
 };
 
 export struct Model : torch::nn::Module {
+  // Defaults to the size of the trained and shipped models.
   struct Config {
-    int32_t action_size;
-    int32_t num_blocks;
-    int32_t num_attention_head;
-    int32_t embedding_dim;
-    int32_t mlp_hidden_size;
-    float32_t mlp_dropout_prob;
+    int32_t action_size = Game::ActionSize;
+    int32_t num_blocks = 10;
+    int32_t num_attention_head = 4;
+    int32_t embedding_dim = 64;
+    int32_t mlp_hidden_size = 128;
+    float32_t mlp_dropout_prob = 0.1;
   };
 
   Model(Config config) : config(config) {
@@ -204,6 +207,8 @@ export struct Model : torch::nn::Module {
   }
 
   auto forward(torch::Tensor x) -> std::tuple<torch::Tensor, torch::Tensor> {
+    auto span = az::trace::Span("Model::forward", /*sampled=*/true);
+
     x = embedding->forward(x);
     auto [out, _] = encoder->forward(x, /*output_attention=*/false);
 
@@ -215,6 +220,29 @@ export struct Model : torch::nn::Module {
     return {wdl, policy};
   }
 
+  // Same as `forward` but with the policy as the softmax over `actions` only,
+  // the (N, K) indices of the legal actions of every position padded with -1.
+  // Only the rows of the policy head of those actions are multiplied, a
+  // handful out of `action_size` in most positions.
+  auto forward_legal(torch::Tensor x, torch::Tensor actions)
+      -> std::tuple<torch::Tensor, torch::Tensor> {
+    auto span = az::trace::Span("Model::forward_legal", /*sampled=*/true);
+
+    x = embedding->forward(x);
+    auto [out, _] = encoder->forward(x, /*output_attention=*/false);
+
+    auto wdl = F::softmax(wdl_head->forward(out), 1);
+
+    actions = actions.to(out.device());
+    auto indices = actions.clamp_min(0).flatten();
+    auto weight = policy_head->weight.index_select(0, indices)
+                      .view({actions.size(0), actions.size(1), -1});
+    auto bias = policy_head->bias.index_select(0, indices).view_as(actions);
+    auto logits = torch::bmm(weight, out.unsqueeze(2)).squeeze(2) + bias;
+
+    return {wdl, az::utils::legal_softmax(logits, actions)};
+  }
+
   Config config;
 
   std::shared_ptr<Encoder> encoder{nullptr};
@@ -224,6 +252,6 @@ export struct Model : torch::nn::Module {
   nn::Linear policy_head{nullptr};
 };
 
-static_assert(az::concepts::Model<Model>);
+static_assert(az::concepts::SparsePolicyModel<Model>);
 
 }  // namespace dz
@@ -0,0 +1,539 @@
+module;
+
+#include <torch/torch.h>
+
+#include <cassert>
+
+export module dz:movegen;
+
+import :board;
+import :cpu;
+import :game;
+
+import az;
+import std;
+
+namespace dz {
+
+// A set of actions with one bit per action, in the order of the actions. Word
+// `4 * (distance - 1) + direction` holds the moves of that distance in that
+// direction of `Board::directions`, and its bit `8 * y + x` the one from the
+// square (x, y).
+export using ActionMask = std::array<uint64_t, Game::ActionSize / 64>;
+
+static_assert(Game::ActionSize % 64 == 0);
+
+// Positions laid out column by column for `generate_moves`, every board as 64
+// bits with the bit `8 * y + x` for the square (x, y), so the kernels load the
+// same board of several positions at once.
+export class StateBatch {
+ public:
+  struct Pieces {
+    uint64_t own = 0;
+    uint64_t enemy = 0;
+    // Of both players.
+    uint64_t damas = 0;
+    // The pieces allowed to move, only the capturing one in the middle of a
+    // capture sequence.
+    uint64_t movable = 0;
+    bool is_first = true;
+    uint8_t draw_count = 0;
+  };
+
+  // The columns are padded with empty positions to whole blocks, so the
+  // kernels never read past them.
+  static constexpr auto BlockSize = 8uz;
+
+  StateBatch() = default;
+
+  explicit StateBatch(std::span<const Game::State> states) {
+    for (auto& state : states)
+      append(state);
+  }
+
+  auto append(const Game::State& state) -> void { append(pieces_of(state)); }
+
+  auto append(const Pieces& pieces) -> void {
+    if (size_ == own_.size()) {
+      for (auto* column : {&own_, &enemy_, &damas_, &movable_, &is_first_})
+        column->resize(size_ + BlockSize);
+    }
+
+    own_[size_] = pieces.own;
+    enemy_[size_] = pieces.enemy;
+    damas_[size_] = pieces.damas;
+    movable_[size_] = pieces.movable;
+    is_first_[size_] = pieces.is_first ? ~uint64_t{0} : 0;
+    draw_counts_.push_back(pieces.draw_count);
+    size_++;
+  }
+
+  static auto pieces_of(const Game::State& state) -> Pieces {
+    auto pieces = Pieces{.is_first = state.player.is_first(),
+                         .draw_count = state.draw_count};
+    for (int8_t y = 0; y < 8; y++) {
+      for (int8_t x = (y + 1) % 2; x < 8; x += 2) {
+        auto cell = state.board[x, y];
+        if (not cell.is_occupied)
+          continue;
+
+        auto square = uint64_t{1} << (8 * y + x);
+        (cell.is_owned_by(state.player) ? pieces.own : pieces.enemy) |= square;
+        if (cell.is_knighted)
+          pieces.damas |= square;
+      }
+    }
+
+    if (state.eating_piece_position.is_empty()) {
+      pieces.movable = pieces.own;
+    } else {
+      auto [x, y] = state.eating_piece_position.value();
+      pieces.movable = uint64_t{1} << (8 * y + x);
+    }
+
+    return pieces;
+  }
+
+  auto pieces(size_t i) const -> Pieces {
+    assert(i < size_);
+    return {.own = own_[i],
+            .enemy = enemy_[i],
+            .damas = damas_[i],
+            .movable = movable_[i],
+            .is_first = is_first_[i] != 0,
+            .draw_count = draw_counts_[i]};
+  }
+
+  auto size() const -> size_t { return size_; }
+
+  auto own() const -> std::span<const uint64_t> { return own_; }
+  auto enemy() const -> std::span<const uint64_t> { return enemy_; }
+  auto damas() const -> std::span<const uint64_t> { return damas_; }
+  auto movable() const -> std::span<const uint64_t> { return movable_; }
+  // All ones for the positions where the first player moves, so that it can
+  // be used as a mask.
+  auto is_first() const -> std::span<const uint64_t> { return is_first_; }
+
+ private:
+  size_t size_ = 0;
+  std::vector<uint64_t> own_;
+  std::vector<uint64_t> enemy_;
+  std::vector<uint64_t> damas_;
+  std::vector<uint64_t> movable_;
+  std::vector<uint64_t> is_first_;
+  std::vector<uint8_t> draw_counts_;
+};
+
+export struct GeneratedMoves {
+  ActionMask legal{};
+  // Whether the legal actions capture, in which case the player must play
+  // one of them.
+  bool is_capture = false;
+  // Without legal actions or with the draw counter run out. Positions only
+  // decided by the tablebase are not detected.
+  bool is_terminal = false;
+};
+
+namespace movegen {
+
+// The moves of a position before the capture rules pick among them.
+struct Candidates {
+  ActionMask captures{};
+  ActionMask quiet{};
+};
+
+using Kernel = auto (*)(const StateBatch&) -> std::vector<Candidates>;
+
+constexpr auto FileA = uint64_t{0x0101010101010101};
+constexpr auto FileH = FileA << 7;
+
+// One square in every direction of `Board::directions` is a shift of the
+// board, after dropping the squares that would leave it sideways.
+struct Step {
+  uint64_t keep;
+  int32_t amount;
+  bool is_up;
+};
+
+constexpr auto steps = std::array<Step, 4>{{
+    {~FileA, 7, true},
+    {~FileH, 9, true},
+    {~FileA, 9, false},
+    {~FileH, 7, false},
+}};
+
+// The candidate moves of the positions in the lanes of `Lanes`, a 64 bit
+// integer or a vector of them, one word of `captures` and `quiet` per word of
+// `ActionMask`. For every direction it walks the boards of the squares ahead
+// of every piece back onto the pieces, one distance at a time, so every lane
+// sees whether its squares ahead are empty, hold an enemy or were crossed by
+// a capture.
+//
+// Takes the vectors by reference and is always inlined, so they are never
+// passed by value, which g++ warns about, and the instructions are those of
+// the caller's target.
+template <typename Lanes>
+[[gnu::always_inline]] inline auto generate_lanes(
+    const Lanes& own, const Lanes& enemy, const Lanes& damas,
+    const Lanes& movable, const Lanes& is_first, Lanes* captures, Lanes* quiet)
+    -> void {
+  // The light squares count as empty, diagonal moves never reach them.
+  const Lanes empty = ~(own | enemy);
+  const Lanes movable_men = movable & ~damas;
+  const Lanes movable_damas = movable & damas;
+
+  for (auto direction = 0; direction < 4; direction++) {
+    // From the squares ahead back to the pieces.
+    auto [keep, amount, is_up] = steps[3 - direction];
+    // Men only move forward without capturing.
+    const Lanes forward_men =
+        movable_men & (direction < 2 ? is_first : ~is_first);
+
+    Lanes empty_ahead = empty;
+    Lanes enemy_ahead = enemy;
+    // The pieces with only empty squares up to the distance.
+    Lanes is_clear = ~Lanes{};
+    // The pieces that crossed exactly one enemy and then only empty squares.
+    Lanes has_crossed = Lanes{};
+
+    for (auto distance = 1; distance <= 7; distance++) {
+      if (is_up) {
+        empty_ahead = (empty_ahead & keep) << amount;
+        enemy_ahead = (enemy_ahead & keep) << amount;
+      } else {
+        empty_ahead = (empty_ahead & keep) >> amount;
+        enemy_ahead = (enemy_ahead & keep) >> amount;
+      }
+
+      const Lanes landing = has_crossed & empty_ahead;
+      has_crossed = landing | (is_clear & enemy_ahead);
+      is_clear &= empty_ahead;
+
+      auto word = 4 * (distance - 1) + direction;
+      // Men capture the adjacent enemy only.
+      captures[word] = landing & (distance == 2 ? movable : movable_damas);
+      quiet[word] = is_clear & (distance == 1 ? movable_damas | forward_men
+                                              : movable_damas);
+    }
+  }
+}
+
+// The candidate moves of the block of positions of `batch` from `start`.
+template <typename Lanes>
+[[gnu::always_inline]] inline auto generate_block(const StateBatch& batch,
+                                                  size_t start,
+                                                  std::span<Candidates> out)
+    -> void {
+  constexpr auto Width = sizeof(Lanes) / sizeof(uint64_t);
+  static_assert(StateBatch::BlockSize % Width == 0);
+
+  Lanes own, enemy, damas, movable, is_first;
+  std::memcpy(&own, batch.own().data() + start, sizeof(Lanes));
+  std::memcpy(&enemy, batch.enemy().data() + start, sizeof(Lanes));
+  std::memcpy(&damas, batch.damas().data() + start, sizeof(Lanes));
+  std::memcpy(&movable, batch.movable().data() + start, sizeof(Lanes));
+  std::memcpy(&is_first, batch.is_first().data() + start, sizeof(Lanes));
+
+  Lanes captures[std::tuple_size_v<ActionMask>];
+  Lanes quiet[std::tuple_size_v<ActionMask>];
+  generate_lanes(own, enemy, damas, movable, is_first, captures, quiet);
+
+  auto lanes = std::array<uint64_t, Width>{};
+  auto count = std::min(Width, batch.size() - start);
+  for (auto word : std::views::iota(0uz, std::tuple_size_v<ActionMask>)) {
+    std::memcpy(lanes.data(), &captures[word], sizeof(Lanes));
+    for (auto lane : std::views::iota(0uz, count))
+      out[start + lane].captures[word] = lanes[lane];
+
+    std::memcpy(lanes.data(), &quiet[word], sizeof(Lanes));
+    for (auto lane : std::views::iota(0uz, count))
+      out[start + lane].quiet[word] = lanes[lane];
+  }
+}
+
+template <typename Lanes>
+[[gnu::always_inline]] inline auto generate_candidates(
+    const StateBatch& batch) -> std::vector<Candidates> {
+  constexpr auto Width = sizeof(Lanes) / sizeof(uint64_t);
+
+  auto candidates = std::vector<Candidates>(batch.size());
+  for (auto start = 0uz; start < batch.size(); start += Width)
+    generate_block<Lanes>(batch, start, candidates);
+  return candidates;
+}
+
+namespace scalar {
+
+auto generate(const StateBatch& batch) -> std::vector<Candidates> {
+  return generate_candidates<uint64_t>(batch);
+}
+
+}  // namespace scalar
+
+#if defined(__x86_64__)
+
+namespace avx2 {
+
+typedef uint64_t Lanes __attribute__((vector_size(32)));
+
+[[gnu::target("avx2")]] auto generate(const StateBatch& batch)
+    -> std::vector<Candidates> {
+  return generate_candidates<Lanes>(batch);
+}
+
+}  // namespace avx2
+
+namespace avx512 {
+
+typedef uint64_t Lanes __attribute__((vector_size(64)));
+
+[[gnu::target("avx512f")]] auto generate(const StateBatch& batch)
+    -> std::vector<Candidates> {
+  return generate_candidates<Lanes>(batch);
+}
+
+}  // namespace avx512
+
+#endif
+
+auto kernel(KernelSet set) -> Kernel {
+  if (not is_supported(set))
+    throw std::runtime_error(
+        std::format("The CPU does not support {} kernels.", to_string(set)));
+#if defined(__x86_64__)
+  if (set == KernelSet::Avx512)
+    return avx512::generate;
+  if (set == KernelSet::Avx2)
+    return avx2::generate;
+#endif
+  return scalar::generate;
+}
+
+// The position after the capture `action` when the capturing piece can go on
+// capturing, that is unless it was promoted by the capture.
+auto after_capture(const StateBatch::Pieces& pieces, az::Action action)
+    -> std::optional<StateBatch::Pieces> {
+  const auto distance = action / (8 * 8 * 4) + 1;
+  const auto direction = (action % (8 * 8 * 4)) / (8 * 8);
+  const auto origin = action % (8 * 8);
+
+  const auto [dx, dy] = Board::directions[direction];
+  const auto delta = 8 * dy + dx;
+  const auto landing = origin + distance * delta;
+
+  const auto from = uint64_t{1} << origin;
+  const auto to = uint64_t{1} << landing;
+  const auto is_dama = (pieces.damas & from) != 0;
+  if (not is_dama and landing / 8 == (pieces.is_first ? 7 : 0))
+    return std::nullopt;
+
+  auto captured = uint64_t{0};
+  for (auto enemy_distance = 1; enemy_distance < distance; enemy_distance++)
+    captured |=
+        pieces.enemy & (uint64_t{1} << (origin + enemy_distance * delta));
+  assert(std::popcount(captured) == 1);
+
+  return StateBatch::Pieces{
+      .own = (pieces.own & ~from) | to,
+      .enemy = pieces.enemy & ~captured,
+      .damas = (pieces.damas & ~(from | captured)) | (is_dama ? to : 0),
+      .movable = to,
+      .is_first = pieces.is_first,
+  };
+}
+
+// Calls `visit` with every action of `mask` in ascending order.
+export template <typename Visit>
+auto for_each_action(const ActionMask& mask, Visit&& visit) -> void {
+  for (auto word : std::views::iota(0uz, mask.size())) {
+    for (auto bits = mask[word]; bits != 0; bits &= bits - 1)
+      visit(static_cast<az::Action>(64 * word + std::countr_zero(bits)));
+  }
+}
+
+auto is_empty(const ActionMask& mask) -> bool {
+  return std::ranges::all_of(mask, [](uint64_t bits) { return bits == 0; });
+}
+
+// The candidate moves of a single position, in the scalar lanes.
+auto candidates(const StateBatch::Pieces& pieces) -> Candidates {
+  auto result = Candidates{};
+  generate_lanes<uint64_t>(pieces.own, pieces.enemy, pieces.damas,
+                           pieces.movable, pieces.is_first ? ~uint64_t{0} : 0,
+                           result.captures.data(), result.quiet.data());
+  return result;
+}
+
+// The most pieces a capture sequence that goes on from `pieces` takes.
+auto max_eats(const StateBatch::Pieces& pieces) -> int32_t {
+  auto best = 0;
+  for_each_action(candidates(pieces).captures, [&](az::Action action) {
+    auto next = after_capture(pieces, action);
+    best = std::max(best, 1 + (next ? max_eats(*next) : 0));
+  });
+  return best;
+}
+
+}  // namespace movegen
+
+// The legal actions of every position of `batch` by the rules of
+// `Game::legal_actions`: a player who can capture must play one of the
+// captures that take the most pieces in sequence, and among those one made by
+// a dama when there is one.
+//
+// The candidate moves of all the positions are generated by SIMD kernels, one
+// position per lane. The capture sequences are then followed a capture at a
+// time, the positions after the captures of every sequence of the batch
+// forming the batch of the next step, so they go through the same kernels.
+export auto generate_moves(const StateBatch& batch,
+                           std::optional<KernelSet> kernels = std::nullopt)
+    -> std::vector<GeneratedMoves> {
+  auto generate =
+      movegen::kernel(kernels.value_or(fastest_kernels()));
+  auto candidates = generate(batch);
+
+  struct Capture {
+    size_t position;
+    az::Action action;
+    bool is_dama;
+    int32_t max_eats = 1;
+  };
+
+  // Every capture of the batch, and the positions where a capture can go on
+  // with the index of the capture that started it.
+  auto captures = std::vector<Capture>{};
+  auto sequences = StateBatch{};
+  auto started_by = std::vector<size_t>{};
+  for (auto position : std::views::iota(0uz, batch.size())) {
+    auto pieces = batch.pieces(position);
+    auto visit = [&](az::Action action) {
+      auto origin = uint64_t{1} << (action % (8 * 8));
+      captures.push_back({.position = position,
+                          .action = action,
+                          .is_dama = (pieces.damas & origin) != 0});
+      if (auto next = movegen::after_capture(pieces, action)) {
+        sequences.append(*next);
+        started_by.push_back(captures.size() - 1);
+      }
+    };
+    movegen::for_each_action(candidates[position].captures, visit);
+  }
+
+  for (auto eats = 2; sequences.size() > 0; eats++) {
+    auto next_candidates = generate(sequences);
+    auto next_sequences = StateBatch{};
+    auto next_started_by = std::vector<size_t>{};
+    for (auto i : std::views::iota(0uz, sequences.size())) {
+      auto pieces = sequences.pieces(i);
+      auto visit = [&](az::Action action) {
+        captures[started_by[i]].max_eats = eats;
+        if (auto next = movegen::after_capture(pieces, action)) {
+          next_sequences.append(*next);
+          next_started_by.push_back(started_by[i]);
+        }
+      };
+      movegen::for_each_action(next_candidates[i].captures, visit);
+    }
+
+    sequences = std::move(next_sequences);
+    started_by = std::move(next_started_by);
+  }
+
+  // The longest captures of every position and whether a dama makes one.
+  auto best_eats = std::vector<int32_t>(batch.size(), 0);
+  auto has_dama_eat = std::vector<uint8_t>(batch.size(), false);
+  for (auto& capture : captures) {
+    auto& best = best_eats[capture.position];
+    auto& has_dama = has_dama_eat[capture.position];
+    if (capture.max_eats > best) {
+      best = capture.max_eats;
+      has_dama = false;
+    }
+    if (capture.max_eats == best)
+      has_dama = has_dama or capture.is_dama;
+  }
+
+  auto moves = std::vector<GeneratedMoves>(batch.size());
+  for (auto& capture : captures) {
+    if (capture.max_eats < best_eats[capture.position] or
+        (has_dama_eat[capture.position] and not capture.is_dama))
+      continue;
+
+    auto& legal = moves[capture.position].legal;
+    legal[capture.action / 64] |= uint64_t{1} << (capture.action % 64);
+  }
+
+  for (auto position : std::views::iota(0uz, batch.size())) {
+    auto& generated = moves[position];
+    generated.is_capture = best_eats[position] > 0;
+    if (not generated.is_capture)
+      generated.legal = candidates[position].quiet;
+
+    generated.is_terminal = movegen::is_empty(generated.legal) or
+                            batch.pieces(position).draw_count >= 80;
+  }
+
+  return moves;
+}
+
+// The legal actions of a single position, by the same rules as the batched
+// `generate_moves` but without allocating: the capture sequences are followed
+// depth first, on the stack. Meant for searches that visit one position at a
+// time.
+export auto generate_moves(const Game::State& state) -> GeneratedMoves {
+  auto pieces = StateBatch::pieces_of(state);
+  auto candidates = movegen::candidates(pieces);
+
+  auto moves = GeneratedMoves{};
+  auto best_eats = 0;
+  auto has_dama_eat = false;
+  movegen::for_each_action(candidates.captures, [&](az::Action action) {
+    auto next = movegen::after_capture(pieces, action);
+    auto eats = 1 + (next ? movegen::max_eats(*next) : 0);
+    auto is_dama = (pieces.damas & (uint64_t{1} << (action % (8 * 8)))) != 0;
+
+    // A longer capture, or the first of a dama among the longest, replaces
+    // the captures found so far.
+    if (eats > best_eats or (eats == best_eats and is_dama and
+                             not has_dama_eat)) {
+      moves.legal = {};
+      best_eats = eats;
+      has_dama_eat = is_dama;
+    } else if (eats < best_eats or is_dama != has_dama_eat) {
+      return;
+    }
+    moves.legal[action / 64] |= uint64_t{1} << (action % 64);
+  });
+
+  moves.is_capture = best_eats > 0;
+  if (not moves.is_capture)
+    moves.legal = candidates.quiet;
+  moves.is_terminal =
+      movegen::is_empty(moves.legal) or pieces.draw_count >= 80;
+  return moves;
+}
+
+// In ascending order, like `Game::legal_action_list`.
+export auto to_actions(const ActionMask& mask) -> std::vector<az::Action> {
+  auto actions = std::vector<az::Action>{};
+  movegen::for_each_action(mask, [&](az::Action action) {
+    actions.push_back(action);
+  });
+  return actions;
+}
+
+// The legal actions of every position as the rows of an (N, ActionSize)
+// tensor, like `Game::legal_actions` gives them for one position.
+export auto to_tensor(std::span<const GeneratedMoves> moves) -> torch::Tensor {
+  auto legal_actions = torch::zeros(
+      {static_cast<int64_t>(moves.size()), Game::ActionSize}, torch::kFloat32);
+  auto data = legal_actions.data_ptr<float>();
+  for (auto [i, generated] : std::views::enumerate(moves)) {
+    movegen::for_each_action(generated.legal, [&](az::Action action) {
+      data[i * Game::ActionSize + action] = 1.0;
+    });
+  }
+  return legal_actions;
+}
+
+}  // namespace dz
@@ -0,0 +1,232 @@
+module;
+
+#include <cassert>
+
+export module dz:notation;
+
+import :board;
+import :game;
+
+import az;
+import std;
+
+// Plain text notation for positions and actions, used wherever a position has
+// to cross a process boundary.
+//
+// A position is written as five space separated fields:
+//
+//   <board> <player> <first score>,<second score> <draw count> <eating piece>
+//
+// The board lists the rows from the eighth rank down to the first, separated
+// by '/'. Each row lists its four playable squares from left to right,
+// separated by ','. A square is either '.' or a piece written as its owner
+// ('a' for the first player, 'b' for the second), its signed value and a
+// trailing 'k' when knighted, e.g. "a-11" or "b8k". The player field is 'a' or
+// 'b'. The eating piece is '-' or the square of the piece in the middle of a
+// capture sequence followed by the square it came from, e.g. "d4/b2".
+//
+// Squares are named by file 'a'-'h' and rank '1'-'8' from the first player's
+// side, and an action is written as its origin square followed by its
+// destination square, e.g. "b3c4".
+
+namespace dz {
+
+export auto square_name(int8_t x, int8_t y) -> std::string {
+  assert(Board::validate(x, y));
+  return std::format("{}{}", static_cast<char>('a' + x), y + 1);
+}
+
+export auto parse_square(std::string_view text)
+    -> std::optional<std::pair<int8_t, int8_t>> {
+  if (text.size() != 2)
+    return std::nullopt;
+
+  int8_t x = text[0] - 'a';
+  int8_t y = text[1] - '1';
+  if (not Board::validate(x, y))
+    return std::nullopt;
+
+  return {{x, y}};
+}
+
+export auto to_notation(const Game::State& state) -> std::string {
+  auto text = std::string{};
+
+  for (int8_t y = 7; y >= 0; y--) {
+    for (int8_t x = (y + 1) % 2; x < 8; x += 2) {
+      if (x > 1)
+        text += ',';
+
+      auto cell = state.board[x, y];
+      if (not cell.is_occupied) {
+        text += '.';
+        continue;
+      }
+
+      text += std::format("{}{}{}", cell.is_owned_by_first_player ? 'a' : 'b',
+                          static_cast<int>(cell.value()),
+                          cell.is_knighted ? "k" : "");
+    }
+
+    if (y > 0)
+      text += '/';
+  }
+
+  auto [first_score, second_score] = state.scores;
+  text += std::format(" {} {},{} {} ", state.player.is_first() ? 'a' : 'b',
+                      static_cast<float>(first_score),
+                      static_cast<float>(second_score),
+                      static_cast<int>(state.draw_count));
+
+  if (state.eating_piece_position.is_empty()) {
+    text += '-';
+  } else {
+    auto [x, y] = state.eating_piece_position.value();
+    auto [prev_x, prev_y] = state.eating_piece_previous_position.value();
+    text += square_name(x, y) + "/" + square_name(prev_x, prev_y);
+  }
+
+  return text;
+}
+
+auto split(std::string_view text, char delimiter)
+    -> std::vector<std::string_view> {
+  auto parts = std::vector<std::string_view>{};
+  for (auto part : std::views::split(text, delimiter))
+    parts.emplace_back(part.begin(), part.end());
+  return parts;
+}
+
+template <typename T>
+auto parse_number(std::string_view text) -> std::optional<T> {
+  auto value = T{};
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc{} or end != text.data() + text.size())
+    return std::nullopt;
+  return value;
+}
+
+auto parse_cell(std::string_view text) -> std::optional<Board::Cell> {
+  if (text == ".")
+    return Board::EmptyCell;
+
+  if (text.size() < 2 or (text[0] != 'a' and text[0] != 'b'))
+    return std::nullopt;
+
+  auto cell = Board::Cell{1, text[0] == 'a', 0, 0, 0};
+  text.remove_prefix(1);
+
+  if (text.ends_with('k')) {
+    cell.is_knighted = 1;
+    text.remove_suffix(1);
+  }
+
+  if (text.starts_with('-')) {
+    cell.is_negative = 1;
+    text.remove_prefix(1);
+  }
+
+  auto value = parse_number<int>(text);
+  if (not value or *value < 0 or *value > 15)
+    return std::nullopt;
+
+  cell.unsigned_value = *value;
+  return cell;
+}
+
+export auto from_notation(std::string_view text)
+    -> std::optional<Game::State> {
+  auto fields = split(text, ' ');
+  std::erase_if(fields, [](auto field) { return field.empty(); });
+  if (fields.size() != 5)
+    return std::nullopt;
+
+  auto state = Game::State{};
+  state.board.cells = {};
+
+  auto rows = split(fields[0], '/');
+  if (rows.size() != 8)
+    return std::nullopt;
+
+  for (int8_t y = 7; y >= 0; y--) {
+    auto squares = split(rows[7 - y], ',');
+    if (squares.size() != 4)
+      return std::nullopt;
+
+    for (int8_t x = (y + 1) % 2, i = 0; x < 8; x += 2, i++) {
+      auto cell = parse_cell(squares[i]);
+      if (not cell)
+        return std::nullopt;
+      state.board[x, y] = *cell;
+    }
+  }
+
+  if (fields[1] != "a" and fields[1] != "b")
+    return std::nullopt;
+  state.player = fields[1] == "a" ? az::Player::First : az::Player::Second;
+
+  auto scores = split(fields[2], ',');
+  if (scores.size() != 2)
+    return std::nullopt;
+
+  auto first_score = parse_number<float>(scores[0]);
+  auto second_score = parse_number<float>(scores[1]);
+  if (not first_score or not second_score)
+    return std::nullopt;
+  state.scores = {static_cast<float16_t>(*first_score),
+                  static_cast<float16_t>(*second_score)};
+
+  auto draw_count = parse_number<int>(fields[3]);
+  if (not draw_count or *draw_count < 0 or *draw_count > 80)
+    return std::nullopt;
+  state.draw_count = *draw_count;
+
+  if (fields[4] != "-") {
+    auto squares = split(fields[4], '/');
+    if (squares.size() != 2)
+      return std::nullopt;
+
+    auto position = parse_square(squares[0]);
+    auto previous_position = parse_square(squares[1]);
+    if (not position or not previous_position)
+      return std::nullopt;
+
+    // The capturing piece belongs to the player to move and got there by
+    // jumping along a diagonal.
+    auto [x, y] = *position;
+    auto [previous_x, previous_y] = *previous_position;
+    auto cell = state.board[x, y];
+    if (not cell.is_occupied or not cell.is_owned_by(state.player))
+      return std::nullopt;
+
+    auto distance = std::abs(x - previous_x);
+    if (distance < 2 or distance != std::abs(y - previous_y))
+      return std::nullopt;
+
+    state.eating_piece_position = Position{position->first, position->second};
+    state.eating_piece_previous_position =
+        Position{previous_position->first, previous_position->second};
+  }
+
+  return state;
+}
+
+export auto format_action(const Game::State& state, az::Action action)
+    -> std::string {
+  auto info = Game::decode_action(state, action);
+  auto [x, y] = info.original_position.value();
+  auto [new_x, new_y] = info.new_position.value();
+  return square_name(x, y) + square_name(new_x, new_y);
+}
+
+// Matches `text` against the legal actions of `state`.
+export auto parse_action(const Game::State& state, std::string_view text)
+    -> std::optional<az::Action> {
+  for (auto action : Game::legal_action_list(state))
+    if (format_action(state, action) == text)
+      return action;
+  return std::nullopt;
+}
+
+}  // namespace dz
@@ -0,0 +1,232 @@
+module;
+
+#include <cassert>
+
+export module dz:retrograde;
+
+import :board;
+import :game;
+import :tablebase;
+
+import az;
+import std;
+
+namespace dz {
+
+// Solves every material of a tablebase by retrograde analysis and writes it in
+// the format read by `Tablebase`.
+//
+// Materials are solved in order of increasing piece count, since a capture
+// always leads to a material with fewer pieces. Within a material, the layer
+// with `r` quiet moves left only depends on the layer with `r - 1` moves left
+// and on smaller materials, so layers are solved one after another starting
+// from a single move left, with the entries of a layer split across threads.
+//
+// A capture resets the draw counter, so a smaller material is only ever read
+// at its last layer. Only that layer of every solved material is kept, with
+// the previous layer of the material being solved, and every layer is written
+// out as soon as it is solved.
+export class Retrograde {
+  using State = Game::State;
+
+ public:
+  explicit Retrograde(int32_t max_pieces) : max_pieces_(max_pieces) {
+    assert(max_pieces >= 2 and max_pieces <= MaxTablebasePieces);
+  }
+
+  // Memory the kept layers of `max_pieces` pieces take at most: the last
+  // layer of every material, and two layers of the material being solved.
+  static auto max_memory(int32_t max_pieces) -> uint64_t {
+    auto num_entries = uint64_t{2} * layer_size(max_pieces);
+    for (auto mask : tablebase_materials(max_pieces))
+      num_entries += layer_size(std::popcount(mask));
+    return num_entries * sizeof(float32_t);
+  }
+
+  // Solves every material and writes the tablebase to `path`.
+  auto solve(std::string_view path, int32_t num_threads) -> void {
+    auto materials = tablebase_materials(max_pieces_);
+    auto output = std::ofstream(std::string(path), std::ios::binary);
+    if (not output)
+      throw std::runtime_error(std::format("Cannot write tablebase {}.", path));
+
+    auto header = TablebaseHeader{
+        .magic = TablebaseMagic,
+        .max_pieces = static_cast<uint32_t>(max_pieces_),
+        .num_materials = static_cast<uint32_t>(materials.size()),
+    };
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // The material headers are only known once their layers are solved, so
+    // they are written again at the end.
+    auto headers = std::vector<MaterialHeader>(materials.size());
+    auto headers_position = output.tellp();
+    write_headers(output, headers);
+
+    auto offset = uint64_t{0};
+    for (auto [i, mask] : std::views::zip(std::views::iota(0), materials)) {
+      auto start = std::chrono::steady_clock::now();
+      auto num_layers = solve_material(mask, num_threads, output);
+      headers[i] = {.mask = mask, .num_layers = num_layers, .offset = offset};
+      offset += num_layers * layer_size(std::popcount(mask));
+
+      auto seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+      std::println("Material {}/{} ({:06x}): {} layers in {:.2f}s", i + 1,
+                   materials.size(), mask, num_layers, seconds);
+    }
+
+    output.seekp(headers_position);
+    write_headers(output, headers);
+    if (not output)
+      throw std::runtime_error(std::format("Cannot write tablebase {}.", path));
+  }
+
+ private:
+  static auto write_headers(std::ofstream& output,
+                            std::span<const MaterialHeader> headers) -> void {
+    output.write(reinterpret_cast<const char*>(headers.data()),
+                 headers.size_bytes());
+  }
+
+  // Solves the layers of `mask` and appends them to `output`, returning how
+  // many there are.
+  auto solve_material(uint32_t mask, int32_t num_threads,
+                      std::ofstream& output) -> uint32_t {
+    auto size = layer_size(std::popcount(mask));
+    auto num_layers = uint32_t{0};
+    solving_ = mask;
+
+    for (auto remaining : std::views::iota(1, MaxDrawCount + 1)) {
+      auto layer = std::vector<float32_t>(size);
+      auto next_chunk = std::atomic<uint64_t>{0};
+      constexpr auto ChunkSize = uint64_t{256};
+
+      auto threads = std::vector<std::jthread>{};
+      for (auto _ : std::views::iota(0, num_threads)) {
+        threads.emplace_back([&] {
+          for (auto begin = next_chunk.fetch_add(ChunkSize); begin < size;
+               begin = next_chunk.fetch_add(ChunkSize)) {
+            for (auto index = begin; index < std::min(begin + ChunkSize, size);
+                 index++)
+              layer[index] = solve_entry(mask, index, remaining);
+          }
+        });
+      }
+      threads.clear();
+
+      // Once a layer repeats, every later layer repeats as well.
+      auto same_bits = [](float32_t a, float32_t b) {
+        return std::bit_cast<uint32_t>(a) == std::bit_cast<uint32_t>(b);
+      };
+      if (num_layers > 0 and std::ranges::equal(layer, previous_, same_bits))
+        break;
+
+      auto entries = std::vector<float16_t>(layer.begin(), layer.end());
+      output.write(reinterpret_cast<const char*>(entries.data()),
+                   entries.size() * sizeof(float16_t));
+      previous_ = std::move(layer);
+      num_layers++;
+    }
+
+    solved_[mask] = std::move(previous_);
+    previous_ = {};
+    return num_layers;
+  }
+
+  auto solve_entry(uint32_t mask, uint64_t index, int32_t remaining) const
+      -> float32_t {
+    auto board = tablebase_board(mask, index);
+    if (not board)
+      return std::numeric_limits<float32_t>::quiet_NaN();
+
+    auto state = State{
+        .board = *board,
+        .draw_count = static_cast<uint8_t>(MaxDrawCount - remaining),
+        .player = az::Player::First,
+    };
+    return search(state);
+  }
+
+  // Margin of the side to move, see `Tablebase`.
+  auto value(const State& state) const -> float32_t {
+    if (state.draw_count >= MaxDrawCount)
+      return piece_margin(state);
+
+    if (state.eating_piece_position.is_empty()) {
+      if (auto margin = lookup(state))
+        return *margin;
+    }
+
+    return search(state);
+  }
+
+  // Margin of the side to move from its legal actions, used for positions
+  // that are not stored: the one being solved, the middle of a capture
+  // sequence and positions where one player has no pieces left.
+  auto search(const State& state) const -> float32_t {
+    auto actions = Game::legal_action_list(state);
+    if (actions.empty())
+      return piece_margin(state);
+
+    auto best = -std::numeric_limits<float32_t>::infinity();
+    for (auto action : actions) {
+      auto next = Game::apply_action(state, action);
+      auto gain = score(next, state.player) - score(state, state.player);
+      auto margin = next.player == state.player ? gain + value(next)
+                                                : gain - value(next);
+      best = std::max(best, margin);
+    }
+    return best;
+  }
+
+  auto lookup(const State& state) const -> std::optional<float32_t> {
+    auto index =
+        tablebase_index(state.board, state.player.is_first(), max_pieces_);
+    if (not index)
+      return std::nullopt;
+
+    // A quiet move stays in the material being solved and reaches the layer
+    // with one move less left, the one solved last.
+    if (index->mask == solving_) {
+      assert(not previous_.empty());
+      return previous_[index->index];
+    }
+
+    // A capture leads to a solved material with the draw counter reset, which
+    // is always at its last layer.
+    assert(state.draw_count == 0);
+    return solved_.at(index->mask)[index->index];
+  }
+
+  static auto score(const State& state, az::Player player) -> float32_t {
+    return player.is_first() ? state.scores.first : state.scores.second;
+  }
+
+  // Value of the pieces left on the board from the side to move's point of
+  // view, which is added to the scores when the game ends.
+  static auto piece_margin(const State& state) -> float32_t {
+    auto margin = 0.0f;
+    for (auto& row : state.board.cells) {
+      for (auto cell : row) {
+        if (not cell.is_occupied)
+          continue;
+
+        auto value = cell.value() * (cell.is_knighted ? 2 : 1);
+        margin += cell.is_owned_by(state.player) ? value : -value;
+      }
+    }
+    return margin;
+  }
+
+  int32_t max_pieces_;
+
+  // The last layer of every solved material.
+  std::unordered_map<uint32_t, std::vector<float32_t>> solved_;
+  // The material being solved and its layer with one move less left.
+  uint32_t solving_ = 0;
+  std::vector<float32_t> previous_;
+};
+
+}  // namespace dz
@@ -0,0 +1,334 @@
+module;
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+
+export module dz:tablebase;
+
+import :board;
+
+import az;
+import std;
+
+// Endgame tablebase of every position with up to `max_pieces` pieces where
+// both players still have a piece.
+//
+// An entry stores the margin, the side to move's final score minus the
+// opponent's, that the side to move gains from the position onwards under
+// perfect play, including the value of the pieces left on the board at the
+// end. Since it does not depend on the scores accumulated so far, the outcome
+// of a position is the sign of its current score difference plus the margin.
+// Because a player can guarantee the margin and the opponent can hold them to
+// it, this gives the exact win/draw/loss result for any score difference.
+//
+// Positions are always stored from the point of view of the side to move: if
+// the second player is to move, the board is rotated by 180 degrees and the
+// owners are swapped, which maps Damath onto itself.
+//
+// The margin also depends on how many quiet moves are left before the draw
+// counter runs out, so every material has one layer per number of remaining
+// moves. Layers are only stored until they stop changing, after which every
+// later layer is identical.
+//
+// File layout: a `TablebaseHeader`, `num_materials` `MaterialHeader`s, then
+// the layers of every material as `float16_t`, NaN marking impossible
+// placements.
+
+namespace dz {
+
+export inline constexpr auto MaxTablebasePieces = 4;
+inline constexpr auto NumPieceIdentities = 24;
+inline constexpr auto MaxDrawCount = 80;
+
+// Margins this close to zero are draws, which absorbs the rounding of the
+// `float16_t` scores the game itself keeps.
+inline constexpr auto DrawTolerance = 1e-2f;
+
+struct TablebaseHeader {
+  std::array<char, 8> magic;
+  uint32_t max_pieces;
+  uint32_t num_materials;
+};
+
+struct MaterialHeader {
+  // Set of piece identities, see `piece_identity`.
+  uint32_t mask;
+  uint32_t num_layers;
+  // Offset of the first layer in entries from the end of the headers.
+  uint64_t offset;
+};
+
+inline constexpr auto TablebaseMagic =
+    std::array<char, 8>{'D', 'Z', 'T', 'B', '0', '0', '0', '1'};
+
+// The 32 playable squares, numbered as in `Game::encode_state`.
+constexpr auto square_index(int8_t x, int8_t y) -> int32_t {
+  return 4 * y + x / 2;
+}
+
+constexpr auto square_position(int32_t square) -> std::pair<int8_t, int8_t> {
+  int8_t y = square / 4;
+  int8_t x = 2 * (square % 4) + (y % 2 == 0 ? 1 : 0);
+  return {x, y};
+}
+
+// Every player owns one piece of each value in {0, 2, ..., 10} and
+// {-1, -3, ..., -11}, so a piece is identified by its owner and its value:
+// identities 0-11 belong to the side to move and 12-23 to the opponent.
+constexpr auto piece_identity(Board::Cell cell, bool is_own)
+    -> std::optional<int32_t> {
+  auto value = static_cast<int32_t>(cell.value());
+  auto slot = -1;
+  if (value >= 0 and value <= 10 and value % 2 == 0)
+    slot = value / 2;
+  else if (value < 0 and value >= -11 and value % 2 != 0)
+    slot = 6 + (-value - 1) / 2;
+  else
+    return std::nullopt;
+
+  return is_own ? slot : 12 + slot;
+}
+
+constexpr auto piece_cell(int32_t identity, bool is_knighted) -> Board::Cell {
+  auto slot = identity % 12;
+  auto is_negative = slot >= 6;
+  auto unsigned_value = is_negative ? 2 * (slot - 6) + 1 : 2 * slot;
+  return Board::Cell{1, identity < 12, is_knighted, is_negative,
+                     static_cast<uint8_t>(unsigned_value)};
+}
+
+// Every layer holds 64 entries per piece: 32 squares times the knighted flag,
+// with the pieces ordered by identity.
+constexpr auto layer_size(int32_t num_pieces) -> uint64_t {
+  return uint64_t{1} << (6 * num_pieces);
+}
+
+constexpr auto layer_index(int32_t draw_count, uint32_t num_layers)
+    -> uint32_t {
+  assert(draw_count < MaxDrawCount);
+  auto remaining = static_cast<uint32_t>(MaxDrawCount - draw_count);
+  return std::min(remaining, num_layers) - 1;
+}
+
+struct TablebaseIndex {
+  uint32_t mask;
+  uint64_t index;
+};
+
+// Locates `board` with `first_to_move` to move in the tablebase.
+auto tablebase_index(const Board& board, bool first_to_move,
+                     int32_t max_pieces) -> std::optional<TablebaseIndex> {
+  auto pieces = std::array<std::pair<int32_t, uint32_t>, MaxTablebasePieces>{};
+  auto num_pieces = 0;
+
+  for (int8_t y = 0; y < 8; y++) {
+    for (int8_t x = 0; x < 8; x++) {
+      auto cell = board[x, y];
+      if (not cell.is_occupied)
+        continue;
+
+      if (num_pieces == max_pieces)
+        return std::nullopt;
+
+      auto is_own = static_cast<bool>(cell.is_owned_by_first_player) ==
+                    first_to_move;
+      auto identity = piece_identity(cell, is_own);
+      if (not identity)
+        return std::nullopt;
+
+      // Rotate the board when the second player is to move.
+      auto square = first_to_move ? square_index(x, y)
+                                  : square_index(7 - x, 7 - y);
+      auto code = static_cast<uint32_t>(2 * square + cell.is_knighted);
+      pieces[num_pieces++] = {*identity, code};
+    }
+  }
+
+  std::ranges::sort(pieces.begin(), pieces.begin() + num_pieces);
+
+  auto mask = uint32_t{0};
+  auto index = uint64_t{0};
+  for (auto i = 0; i < num_pieces; i++) {
+    auto [identity, code] = pieces[i];
+    if (mask & (1u << identity))
+      return std::nullopt;
+
+    mask |= 1u << identity;
+    index |= uint64_t{code} << (6 * i);
+  }
+
+  auto has_own = (mask & 0xfff) != 0;
+  auto has_opponent = (mask >> 12) != 0;
+  if (not has_own or not has_opponent)
+    return std::nullopt;
+
+  return TablebaseIndex{.mask = mask, .index = index};
+}
+
+// Places the pieces of `mask` as described by `index` with the side to move
+// owning identities 0-11 as the first player, or nothing if two pieces share
+// a square.
+auto tablebase_board(uint32_t mask, uint64_t index) -> std::optional<Board> {
+  auto board = Board{};
+  board.cells = {};
+
+  auto i = 0;
+  for (auto identity : std::views::iota(0, NumPieceIdentities)) {
+    if (not(mask & (1u << identity)))
+      continue;
+
+    auto code = (index >> (6 * i++)) & 63;
+    auto [x, y] = square_position(static_cast<int32_t>(code >> 1));
+    if (board[x, y].is_occupied)
+      return std::nullopt;
+
+    board[x, y] = piece_cell(identity, code & 1);
+  }
+
+  return board;
+}
+
+// Materials with both players present, ordered by number of pieces so that
+// every capture leads to a material that comes earlier.
+auto tablebase_materials(int32_t max_pieces) -> std::vector<uint32_t> {
+  auto materials = std::vector<uint32_t>{};
+  for (auto num_pieces : std::views::iota(2, max_pieces + 1)) {
+    for (auto mask = uint32_t{0}; mask < (1u << NumPieceIdentities); mask++) {
+      if (std::popcount(mask) != num_pieces)
+        continue;
+      if ((mask & 0xfff) == 0 or (mask >> 12) == 0)
+        continue;
+      materials.push_back(mask);
+    }
+  }
+  return materials;
+}
+
+export class Tablebase {
+  struct Table {
+    uint32_t num_layers;
+    const float16_t* data;
+  };
+
+ public:
+  // Maps the tablebase at `path` into memory.
+  static auto load(std::string_view path) -> std::shared_ptr<const Tablebase> {
+    auto fd = ::open(std::string(path).c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error(std::format("Cannot open tablebase {}.", path));
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw std::runtime_error(std::format("Cannot stat tablebase {}.", path));
+    }
+
+    auto size = static_cast<size_t>(info.st_size);
+    auto mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+      throw std::runtime_error(std::format("Cannot map tablebase {}.", path));
+
+    auto tablebase = std::shared_ptr<Tablebase>(new Tablebase(mapping, size));
+
+    auto bytes = static_cast<const std::byte*>(mapping);
+    if (size < sizeof(TablebaseHeader))
+      throw std::runtime_error(std::format("Truncated tablebase {}.", path));
+
+    auto header = TablebaseHeader{};
+    std::memcpy(&header, bytes, sizeof(TablebaseHeader));
+    if (header.magic != TablebaseMagic or
+        header.max_pieces > MaxTablebasePieces)
+      throw std::runtime_error(std::format("Invalid tablebase {}.", path));
+
+    auto headers_size = sizeof(TablebaseHeader) +
+                        header.num_materials * sizeof(MaterialHeader);
+    if (size < headers_size)
+      throw std::runtime_error(std::format("Truncated tablebase {}.", path));
+
+    auto data = reinterpret_cast<const float16_t*>(bytes + headers_size);
+    auto num_entries = (size - headers_size) / sizeof(float16_t);
+
+    tablebase->max_pieces_ = header.max_pieces;
+    for (auto i : std::views::iota(uint32_t{0}, header.num_materials)) {
+      auto material = MaterialHeader{};
+      auto offset = sizeof(TablebaseHeader) + i * sizeof(MaterialHeader);
+      std::memcpy(&material, bytes + offset, sizeof(MaterialHeader));
+
+      auto end = material.offset + material.num_layers *
+                                       layer_size(std::popcount(material.mask));
+      if (material.num_layers == 0 or end > num_entries)
+        throw std::runtime_error(std::format("Truncated tablebase {}.", path));
+
+      tablebase->tables_[material.mask] = {
+          .num_layers = material.num_layers,
+          .data = data + material.offset,
+      };
+    }
+
+    return tablebase;
+  }
+
+  Tablebase(const Tablebase&) = delete;
+  auto operator=(const Tablebase&) -> Tablebase& = delete;
+
+  ~Tablebase() { ::munmap(mapping_, size_); }
+
+  auto max_pieces() const -> int32_t { return max_pieces_; }
+
+  // The margin of the side to move, or nothing if the position is not in the
+  // tablebase. Positions in the middle of a capture sequence are never stored.
+  auto probe(const Board& board, az::Player player, int32_t draw_count) const
+      -> std::optional<float32_t> {
+    if (draw_count >= MaxDrawCount)
+      return std::nullopt;
+
+    auto index = tablebase_index(board, player.is_first(), max_pieces_);
+    if (not index)
+      return std::nullopt;
+
+    auto table = tables_.find(index->mask);
+    if (table == tables_.end())
+      return std::nullopt;
+
+    auto [num_layers, data] = table->second;
+    auto num_pieces = std::popcount(index->mask);
+    auto layer = layer_index(draw_count, num_layers);
+
+    auto margin =
+        static_cast<float>(data[layer * layer_size(num_pieces) + index->index]);
+    if (std::isnan(margin))
+      return std::nullopt;
+
+    return margin;
+  }
+
+ private:
+  Tablebase(void* mapping, size_t size) : mapping_(mapping), size_(size) {}
+
+  void* mapping_;
+  size_t size_;
+
+  int32_t max_pieces_ = 0;
+  std::unordered_map<uint32_t, Table> tables_;
+};
+
+std::shared_ptr<const Tablebase> active_tablebase_owner = nullptr;
+std::atomic<const Tablebase*> active_tablebase_pointer = nullptr;
+
+// Makes `Game::get_outcome` and therefore every search adjudicate the
+// positions covered by `tablebase`. Call it before any game starts.
+export auto use_tablebase(std::shared_ptr<const Tablebase> tablebase) -> void {
+  active_tablebase_pointer = tablebase.get();
+  active_tablebase_owner = std::move(tablebase);
+}
+
+export auto active_tablebase() -> const Tablebase* {
+  return active_tablebase_pointer.load(std::memory_order_relaxed);
+}
+
+}  // namespace dz
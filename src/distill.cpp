@@ -0,0 +1,182 @@
+#include <torch/torch.h>
+
+import az;
+import dz;
+import std;
+
+// Distills a trained model into a smaller one that searches more positions
+// per second, for play where the time per move is short.
+//
+// Usage: DamathZeroDistill TEACHER OUTPUT RECORDS... [--blocks N]
+//                          [--heads N] [--embedding N] [--mlp-hidden N]
+//                          [--epochs N] [--positions N] [--games N]
+//                          [--movetime MS] [--random-plies N] [--seed N]
+//
+// The student learns the teacher's predictions for the positions of the game
+// records, then plays the teacher with the same time per move. The score and
+// the simulations per millisecond of each show whether the faster search
+// makes up for the smaller network.
+
+struct Options {
+  std::vector<std::string> records;
+  int32_t num_blocks = 4;
+  int32_t num_attention_head = 4;
+  int32_t embedding_dim = 32;
+  int32_t mlp_hidden_size = 64;
+  int32_t num_epochs = 4;
+  int64_t max_positions = std::numeric_limits<int64_t>::max();
+  int32_t num_games = 20;
+  int32_t move_time = 100;
+  int32_t random_plies = 4;
+  uint64_t seed = 42;
+};
+
+// The time one side of the match spent searching and how much it searched.
+struct SearchCost {
+  int64_t num_simulations = 0;
+  double milliseconds = 0;
+};
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 4) {
+    std::println(std::cerr, "Expected the teacher, output and records paths.");
+    return -1;
+  }
+
+  auto options = Options{};
+  for (auto i = 3; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--blocks" and has_value)
+      options.num_blocks = std::stoi(argv[++i]);
+    else if (flag == "--heads" and has_value)
+      options.num_attention_head = std::stoi(argv[++i]);
+    else if (flag == "--embedding" and has_value)
+      options.embedding_dim = std::stoi(argv[++i]);
+    else if (flag == "--mlp-hidden" and has_value)
+      options.mlp_hidden_size = std::stoi(argv[++i]);
+    else if (flag == "--epochs" and has_value)
+      options.num_epochs = std::stoi(argv[++i]);
+    else if (flag == "--positions" and has_value)
+      options.max_positions = std::stoll(argv[++i]);
+    else if (flag == "--games" and has_value)
+      options.num_games = std::stoi(argv[++i]);
+    else if (flag == "--movetime" and has_value)
+      options.move_time = std::stoi(argv[++i]);
+    else if (flag == "--random-plies" and has_value)
+      options.random_plies = std::stoi(argv[++i]);
+    else if (flag == "--seed" and has_value)
+      options.seed = std::stoull(argv[++i]);
+    else if (flag.starts_with("--")) {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    } else
+      options.records.emplace_back(flag);
+  }
+
+  auto teacher = dz::load_model(argv[1], {});
+  auto student = std::make_shared<dz::Model>(dz::Model::Config{
+      .num_blocks = options.num_blocks,
+      .num_attention_head = options.num_attention_head,
+      .embedding_dim = options.embedding_dim,
+      .mlp_hidden_size = options.mlp_hidden_size,
+  });
+
+  // Every position played in the records, searched or not.
+  auto states = std::vector<dz::Game::State>{};
+  for (auto& path : options.records) {
+    auto reader = az::RecordReader(path);
+    while (auto record = reader.next()) {
+      az::replay<dz::Game>(*record, [&](const dz::Game::State& state,
+                                        const az::GameRecord::Move&) {
+        if (std::ssize(states) < options.max_positions)
+          states.push_back(state);
+      });
+    }
+  }
+  if (states.empty()) {
+    std::println(std::cerr, "Expected positions in the records.");
+    return -1;
+  }
+  std::println(std::cerr, "Distilling on {} positions.", states.size());
+
+  auto damathzero = dz::DamathZero{{
+      .batch_size = 64,
+      .num_training_epochs = options.num_epochs,
+      .device = dz::DeviceType::CPU,
+      .seed = options.seed,
+  }};
+  damathzero.distill(teacher, student, states);
+  dz::save_model(student, argv[2]);
+
+  teacher->eval();
+  student->eval();
+  torch::NoGradGuard no_grad;
+
+  // Searches until the deadline of every move, so the side with the faster
+  // network gets more simulations.
+  auto mcts = dz::MCTS{{.num_simulations = dz::MCTS::UntilStopped}};
+  auto teacher_cost = SearchCost{};
+  auto student_cost = SearchCost{};
+  auto wins = 0;
+  auto draws = 0;
+  auto losses = 0;
+
+  for (auto game : std::views::iota(0, options.num_games)) {
+    auto gen = az::make_generator(options.seed, game);
+    auto state = dz::Game::initial_state(gen);
+    // The student plays the first player in even games.
+    auto student_first = game % 2 == 0;
+
+    for (auto ply = 0;; ply++) {
+      auto is_student = state.player.is_first() == student_first;
+      auto& cost = is_student ? student_cost : teacher_cost;
+
+      auto start = dz::MCTS::Clock::now();
+      mcts.set_stop_condition(start +
+                              std::chrono::milliseconds(options.move_time));
+      auto probs = mcts.search(state, is_student ? student : teacher);
+      cost.milliseconds += std::chrono::duration<double, std::milli>(
+                               dz::MCTS::Clock::now() - start)
+                               .count();
+      cost.num_simulations += mcts.last_statistics().num_simulations;
+
+      auto action = ply < options.random_plies
+                        ? az::sample_action(probs, gen)
+                        : torch::argmax(probs).item<dz::Action>();
+
+      auto new_state = dz::Game::apply_action(state, action);
+      if (auto outcome = dz::Game::get_outcome(new_state, action)) {
+        // From the point of view of the student.
+        auto result = is_student ? *outcome : outcome->flip();
+        if (result == dz::GameOutcome::Win)
+          wins++;
+        else if (result == dz::GameOutcome::Draw)
+          draws++;
+        else
+          losses++;
+        break;
+      }
+
+      state = std::move(new_state);
+    }
+
+    std::println(std::cerr, "Played {} of {} games.", game + 1,
+                 options.num_games);
+  }
+
+  auto per_millisecond = [](const SearchCost& cost) {
+    return cost.milliseconds > 0
+               ? static_cast<double>(cost.num_simulations) / cost.milliseconds
+               : 0.0;
+  };
+  std::println("Teacher: {:.2f} simulations/ms", per_millisecond(teacher_cost));
+  std::println("Student: {:.2f} simulations/ms", per_millisecond(student_cost));
+  std::println(
+      "Student against teacher at {} ms per move: {} wins, {} draws, {} losses "
+      "({:.1f}%)",
+      options.move_time, wins, draws, losses,
+      options.num_games > 0
+          ? 100.0 * (wins + 0.5 * draws) / options.num_games
+          : 0.0);
+}
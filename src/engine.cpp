@@ -0,0 +1,232 @@
+#include <torch/torch.h>
+
+import az;
+import dz;
+import std;
+
+// Plays with a model over a line protocol on stdin and stdout, so that match
+// runners can play many games in parallel without a display.
+//
+// Usage: DamathZeroEngine MODEL [--simulations N] [--book PATH]
+//
+// Commands, one per line:
+//
+//   isready               replies readyok
+//   newgame               sets up the starting position
+//   position startpos|<notation> [moves <move>...]
+//   legal                 replies legal <move>...
+//   go [nodes N] [movetime MS] [infinite]
+//                         searches the position, then replies
+//                         info nodes <simulations> time <ms> and
+//                         bestmove <move>
+//   ponder                searches the position until the next command
+//   stop                  ends the running search, a go still replies
+//   quit
+//
+// Moves are the origin and destination squares, such as c3d4, and the
+// starting position has the first player to move. `go` searches for
+// `--simulations` by default, `movetime` and `infinite` search until the time
+// is up or until `stop`. Any other command ends a running search first.
+//
+// The search tree is kept between commands, so a search from a position
+// reached in a move or two from the last searched one, like after the reply
+// that was pondered on, starts from what was already found.
+
+struct Options {
+  int32_t num_simulations = 1000;
+  std::optional<std::string> opening_book_path = std::nullopt;
+};
+
+using Clock = dz::MCTS::Clock;
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 2) {
+    std::println(std::cerr, "Expected the model path.");
+    return -1;
+  }
+
+  auto options = Options{};
+  for (auto i = 2; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--simulations" and has_value)
+      options.num_simulations = std::stoi(argv[++i]);
+    else if (flag == "--book" and has_value)
+      options.opening_book_path = argv[++i];
+    else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  auto start_state = dz::Game::initial_state();
+  start_state.player = dz::Player::First;
+
+  auto app = dz::Application({.num_simulations = options.num_simulations,
+                              .opening_book_path = options.opening_book_path,
+                              .reuse_tree = true},
+                             {},
+                             argv[1], start_state);
+
+  // Replies of the search thread and of the main thread must not interleave.
+  auto output_mutex = std::mutex{};
+  auto reply = [&](std::string_view line) {
+    auto guard = std::lock_guard(output_mutex);
+    std::println(std::cout, "{}", line);
+    std::cout.flush();
+  };
+
+  auto set_position = [&](dz::Game::State state) {
+    app.state = state;
+    app.outcome = std::nullopt;
+    app.history = {state};
+  };
+
+  // Only one search runs at a time, on its own thread so that `stop` can be
+  // read while it runs. A ponder search replies nothing.
+  auto search = std::jthread{};
+  auto start_search = [&](int32_t num_simulations,
+                          std::optional<Clock::time_point> deadline,
+                          bool is_ponder) {
+    search = std::jthread([&, num_simulations, deadline,
+                           is_ponder](std::stop_token stop) {
+      auto start = Clock::now();
+      app.mcts.set_stop_condition(deadline, stop);
+      auto probs = app.search(num_simulations);
+      if (is_ponder)
+        return;
+
+      auto elapsed =
+          std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                                start);
+      auto action = torch::argmax(probs).item<dz::Action>();
+      reply(std::format("info nodes {} time {}",
+                        app.mcts.last_statistics().num_simulations,
+                        elapsed.count()));
+      reply(std::format("bestmove {}", dz::format_action(app.state, action)));
+    });
+  };
+  auto stop_search = [&] {
+    if (search.joinable()) {
+      search.request_stop();
+      search.join();
+    }
+  };
+
+  auto line = std::string{};
+  while (std::getline(std::cin, line)) {
+    auto stream = std::istringstream(line);
+    auto words = std::vector<std::string>{};
+    for (auto word = std::string{}; stream >> word;)
+      words.push_back(word);
+
+    if (words.empty())
+      continue;
+
+    auto& command = words[0];
+    if (command == "isready") {
+      reply("readyok");
+      continue;
+    }
+
+    stop_search();
+
+    if (command == "quit") {
+      break;
+    } else if (command == "stop") {
+      continue;
+    } else if (command == "newgame") {
+      set_position(start_state);
+    } else if (command == "position") {
+      auto moves = std::ranges::find(words, "moves");
+      auto setup = std::ranges::subrange(words.begin() + 1, moves);
+
+      auto state = std::optional<dz::Game::State>{};
+      if (setup.size() == 1 and setup.front() == "startpos")
+        state = start_state;
+      else
+        state = dz::from_notation(setup | std::views::join_with(' ') |
+                                  std::ranges::to<std::string>());
+      if (not state) {
+        reply(std::format("error cannot parse position {}", line));
+        continue;
+      }
+
+      // Moves after the end of the game are illegal too.
+      auto outcome = std::optional<dz::GameOutcome>{};
+      for (auto& move : std::ranges::subrange(moves, words.end()) |
+                            std::views::drop(1)) {
+        auto action = std::optional<dz::Action>{};
+        if (not outcome)
+          action = dz::parse_action(*state, move);
+        if (not action) {
+          reply(std::format("error illegal move {}", move));
+          state = std::nullopt;
+          break;
+        }
+
+        state = dz::Game::apply_action(*state, *action);
+        outcome = dz::Game::get_outcome(*state, *action);
+      }
+
+      if (state) {
+        set_position(*state);
+        app.outcome = outcome;
+      }
+    } else if (command == "legal") {
+      auto moves = std::string{"legal"};
+      if (not app.outcome) {
+        for (auto action : dz::Game::legal_action_list(app.state))
+          moves += " " + dz::format_action(app.state, action);
+      }
+      reply(moves);
+    } else if (command == "go") {
+      if (app.outcome) {
+        reply("bestmove none");
+        continue;
+      }
+
+      auto nodes = std::optional<int32_t>{};
+      auto deadline = std::optional<Clock::time_point>{};
+      auto is_infinite = false;
+      auto error = std::optional<std::string>{};
+      for (auto i = 1uz; i < words.size() and not error; i++) {
+        auto& name = words[i];
+        if (name == "infinite") {
+          is_infinite = true;
+          continue;
+        }
+        if (name != "nodes" and name != "movetime")
+          continue;
+
+        auto value = int32_t{0};
+        auto text = std::string_view{i + 1 < words.size() ? words[++i] : ""};
+        auto [_, parse_error] =
+            std::from_chars(text.data(), text.data() + text.size(), value);
+        if (parse_error != std::errc{})
+          error = std::format("error expected a number after {}", name);
+        else if (name == "nodes")
+          nodes = std::max(1, value);
+        else
+          deadline = Clock::now() + std::chrono::milliseconds(value);
+      }
+
+      if (error) {
+        reply(*error);
+        continue;
+      }
+
+      auto num_simulations = nodes.value_or(
+          deadline or is_infinite ? dz::MCTS::UntilStopped
+                                  : options.num_simulations);
+      start_search(num_simulations, deadline, /*is_ponder=*/false);
+    } else if (command == "ponder") {
+      if (not app.outcome)
+        start_search(dz::MCTS::UntilStopped, std::nullopt, /*is_ponder=*/true);
+    } else {
+      reply(std::format("error unknown command {}", command));
+    }
+  }
+
+  stop_search();
+}
@@ -0,0 +1,227 @@
+#include <torch/torch.h>
+
+import az;
+import dz;
+import std;
+
+// Rates the checkpoints written by `learn` against each other with Elo.
+//
+// Usage: DamathZeroLadder [--models DIR] [--cache PATH] [--games N]
+//                         [--anchors N] [--simulations N] [--random-plies N]
+//                         [--threads N] [--seed N]
+//
+// Every checkpoint plays the one before it, then the ones 2, 4, 8... before
+// it, up to `--anchors` opponents, so the ladder stays connected while a new
+// checkpoint only plays a few matches. Games are cached by checkpoint hash and
+// settings, so rerunning after training adds checkpoints only plays their
+// games.
+
+struct Options {
+  std::string models = "models/all_models";
+  std::string cache = "models/ladder.txt";
+  int32_t num_games = 20;
+  int32_t num_anchors = 3;
+  int32_t num_simulations = 200;
+  int32_t random_plies = 4;
+  int32_t num_threads = az::Topology::detect().num_actors();
+  uint64_t seed = 42;
+};
+
+struct Checkpoint {
+  std::string path;
+  uint64_t hash;
+};
+
+// The checkpoints of `directory` by iteration, which is the number in their
+// name.
+auto list_checkpoints(std::string_view directory) -> std::vector<Checkpoint> {
+  auto iteration = [](const std::string& path) {
+    auto name = std::filesystem::path(path).stem().string();
+    auto digits = name | std::views::filter([](char c) {
+                    return std::isdigit(static_cast<unsigned char>(c));
+                  }) |
+                  std::ranges::to<std::string>();
+    return digits.empty() ? int64_t{-1} : std::stoll(digits);
+  };
+
+  auto paths = std::vector<std::string>{};
+  for (auto& entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.path().extension() == ".pt")
+      paths.push_back(entry.path().string());
+  }
+  std::ranges::sort(paths, {}, [&](const std::string& path) {
+    return std::tuple{iteration(path), path};
+  });
+
+  auto checkpoints = std::vector<Checkpoint>{};
+  for (auto& path : paths)
+    checkpoints.push_back({path, az::hash_file(path)});
+  return checkpoints;
+}
+
+auto main(int argc, char** argv) -> int {
+  auto options = Options{};
+  for (auto i = 1; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--models" and has_value)
+      options.models = argv[++i];
+    else if (flag == "--cache" and has_value)
+      options.cache = argv[++i];
+    else if (flag == "--games" and has_value)
+      options.num_games = std::stoi(argv[++i]);
+    else if (flag == "--anchors" and has_value)
+      options.num_anchors = std::stoi(argv[++i]);
+    else if (flag == "--simulations" and has_value)
+      options.num_simulations = std::stoi(argv[++i]);
+    else if (flag == "--random-plies" and has_value)
+      options.random_plies = std::stoi(argv[++i]);
+    else if (flag == "--threads" and has_value)
+      options.num_threads = std::stoi(argv[++i]);
+    else if (flag == "--seed" and has_value)
+      options.seed = std::stoull(argv[++i]);
+    else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  auto checkpoints = list_checkpoints(options.models);
+  if (checkpoints.size() < 2) {
+    std::println(std::cerr, "Expected at least two checkpoints in {}.",
+                 options.models);
+    return -1;
+  }
+
+  auto cache = az::LadderCache(options.cache);
+  auto settings = az::derive_seed(options.seed, options.num_simulations,
+                                  options.random_plies);
+
+  // Pairs of checkpoint indices, the older one first.
+  auto num_checkpoints = static_cast<int32_t>(checkpoints.size());
+  auto pairs = std::vector<std::pair<int32_t, int32_t>>{};
+  for (auto newer : std::views::iota(1, num_checkpoints)) {
+    auto distance = 1;
+    for (auto _ : std::views::iota(0, options.num_anchors)) {
+      if (distance > newer)
+        break;
+      pairs.emplace_back(newer - distance, newer);
+      distance *= 2;
+    }
+  }
+
+  auto pairing = [&](std::pair<int32_t, int32_t> pair) {
+    return az::Pairing{checkpoints[pair.first].hash,
+                       checkpoints[pair.second].hash, settings};
+  };
+
+  struct Job {
+    int32_t pair;
+    int32_t game;
+  };
+  auto jobs = std::vector<Job>{};
+  for (auto [i, pair] : std::views::enumerate(pairs)) {
+    for (auto game : std::views::iota(0, options.num_games)) {
+      if (not cache.has_played(pairing(pair), game))
+        jobs.push_back({static_cast<int32_t>(i), game});
+    }
+  }
+  std::println(std::cerr, "{} checkpoints, {} pairings, {} games to play.",
+               checkpoints.size(), pairs.size(), jobs.size());
+
+  // Loaded the first time a game needs them and shared by every thread.
+  auto models = std::vector<std::shared_ptr<dz::Model>>(checkpoints.size());
+  auto models_mutex = std::mutex{};
+  auto model = [&](int32_t checkpoint) {
+    auto guard = std::lock_guard(models_mutex);
+    if (not models[checkpoint]) {
+      models[checkpoint] = dz::load_model(checkpoints[checkpoint].path, {});
+      models[checkpoint]->eval();
+    }
+    return models[checkpoint];
+  };
+
+  auto num_threads = std::max(1, options.num_threads);
+  auto placement = az::Topology::detect().partition(num_threads);
+  az::size_thread_pools(placement);
+  auto scheduler = az::GameScheduler(jobs.size(), num_threads);
+  auto num_played = std::atomic<int32_t>{0};
+
+  auto threads = std::vector<std::thread>{};
+  for (auto worker : std::views::iota(0, num_threads)) {
+    threads.emplace_back([&, worker] {
+      az::pin_thread(placement[worker]);
+
+      while (auto job = scheduler.next(worker)) {
+        auto [pair, game] = jobs[*job];
+        auto [older, newer] = pairs[pair];
+        auto key = pairing(pairs[pair]);
+        // The older checkpoint plays the first player in even games.
+        auto first = model(game % 2 == 0 ? older : newer);
+        auto second = model(game % 2 == 0 ? newer : older);
+
+        // The first moves are sampled so that the games of a pairing do not
+        // all repeat the same greedy line.
+        auto gen = az::make_generator(options.seed, key.first, key.second,
+                                      game);
+        auto mcts = dz::MCTS{{.num_simulations = options.num_simulations,
+                              .prune_decided_root = true}};
+        auto state = dz::Game::initial_state(gen);
+
+        for (auto ply = 0;; ply++) {
+          auto probs = mcts.search(state,
+                                   state.player.is_first() ? first : second);
+          auto action = ply < options.random_plies
+                            ? az::sample_action(probs, gen)
+                            : torch::argmax(probs).item<dz::Action>();
+
+          auto new_state = dz::Game::apply_action(state, action);
+          if (auto outcome = dz::Game::get_outcome(new_state, action)) {
+            // From the point of view of the player who moved, then of the
+            // older checkpoint.
+            auto older_moved = state.player.is_first() == (game % 2 == 0);
+            cache.record(key, game, older_moved ? *outcome : outcome->flip());
+            break;
+          }
+
+          state = std::move(new_state);
+        }
+
+        auto played = ++num_played;
+        if (played % 10 == 0 or played == std::ssize(jobs))
+          std::println(std::cerr, "Played {} of {} games.", played,
+                       jobs.size());
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Warm started from the cached ratings, a new checkpoint from the one
+  // before it.
+  auto ratings = std::vector<float64_t>{};
+  for (auto& checkpoint : checkpoints)
+    ratings.push_back(cache.rating(checkpoint.hash)
+                          .value_or(ratings.empty() ? 0.0 : ratings.back()));
+
+  auto matches = std::vector<az::MatchScore>{};
+  auto num_games = std::vector<int32_t>(checkpoints.size(), 0);
+  for (auto& pair : pairs) {
+    auto score = cache.score(pairing(pair));
+    matches.push_back({pair.first, pair.second, score});
+    num_games[pair.first] += score.games;
+    num_games[pair.second] += score.games;
+  }
+
+  ratings = az::fit_elo(matches, std::move(ratings));
+
+  std::println("{:>8} {:>6}  {}", "elo", "games", "checkpoint");
+  for (auto [checkpoint, elo, games] :
+       std::views::zip(checkpoints, ratings, num_games)) {
+    cache.record_rating(checkpoint.hash, elo);
+    std::println("{:>8.1f} {:>6}  {}", static_cast<double>(elo), games,
+                 checkpoint.path);
+  }
+}
@@ -0,0 +1,287 @@
+#include <torch/torch.h>
+
+import dz;
+import std;
+
+// Counts the leaf nodes of the game tree to a fixed depth using only the move
+// generator, or compares two move generators position by position.
+//
+// The batched generator counts breadth first, generating the moves of many
+// positions per call to `dz::generate_moves`, and "batched-scalar" is the same
+// generator without SIMD kernels for diffing against it.
+//
+// Usage: DamathZeroPerft [--depth N] [--threads N] [--generator NAME]
+//                        [--position NOTATION]... [--divide]
+//                        [--diff REFERENCE CANDIDATE]
+
+using State = dz::Game::State;
+using Generator = auto (*)(const State&) -> std::vector<dz::Action>;
+
+auto tensor_generator(const State& state) -> std::vector<dz::Action> {
+  auto legal_actions = dz::Game::legal_actions(state).nonzero();
+  auto actions = std::vector<dz::Action>{};
+  for (auto i = 0; i < legal_actions.size(0); i++)
+    actions.push_back(legal_actions[i].item<dz::Action>());
+  return actions;
+}
+
+auto batched_generator(const State& state) -> std::vector<dz::Action> {
+  auto moves = dz::generate_moves(dz::StateBatch(std::span(&state, 1)));
+  return dz::to_actions(moves.front().legal);
+}
+
+auto batched_scalar_generator(const State& state) -> std::vector<dz::Action> {
+  auto moves = dz::generate_moves(dz::StateBatch(std::span(&state, 1)),
+                                  dz::KernelSet::Scalar);
+  return dz::to_actions(moves.front().legal);
+}
+
+static const auto generators = std::map<std::string_view, Generator>{
+    {"tensor", tensor_generator},
+    {"list", dz::Game::legal_action_list},
+    {"batched", batched_generator},
+    {"batched-scalar", batched_scalar_generator},
+};
+
+// `get_outcome` ends the game once the draw counter runs out, even when there
+// are legal actions left.
+auto is_drawn_out(const State& state) -> bool {
+  return state.draw_count >= 80;
+}
+
+auto seconds_since(std::chrono::steady_clock::time_point start) -> double {
+  using Seconds = std::chrono::duration<double>;
+  return Seconds(std::chrono::steady_clock::now() - start).count();
+}
+
+auto perft(const State& state, int32_t depth, Generator generate) -> uint64_t {
+  if (depth == 0)
+    return 1;
+
+  if (is_drawn_out(state))
+    return 0;
+
+  auto actions = generate(state);
+  if (depth == 1)
+    return actions.size();
+
+  auto nodes = uint64_t{0};
+  for (auto action : actions)
+    nodes += perft(dz::Game::apply_action(state, action), depth - 1, generate);
+  return nodes;
+}
+
+// Positions generated at once by `batched_perft`, the rest of a level waits
+// until their subtrees are counted.
+constexpr auto PerftBatchSize = 4096uz;
+
+auto batched_perft(std::span<const State> states, int32_t depth,
+                   std::optional<dz::KernelSet> kernels) -> uint64_t {
+  if (depth == 0)
+    return states.size();
+
+  auto moves = dz::generate_moves(dz::StateBatch(states), kernels);
+  auto nodes = uint64_t{0};
+  auto children = std::vector<State>{};
+  for (auto [state, generated] : std::views::zip(states, moves)) {
+    if (is_drawn_out(state))
+      continue;
+
+    if (depth == 1) {
+      for (auto word : generated.legal)
+        nodes += std::popcount(word);
+      continue;
+    }
+
+    for (auto action : dz::to_actions(generated.legal))
+      children.push_back(dz::Game::apply_action(state, action));
+    if (children.size() >= PerftBatchSize) {
+      nodes += batched_perft(children, depth - 1, kernels);
+      children.clear();
+    }
+  }
+
+  if (not children.empty())
+    nodes += batched_perft(children, depth - 1, kernels);
+  return nodes;
+}
+
+auto parallel_perft(const State& root, int32_t depth, Generator generate,
+                    int32_t num_threads) -> uint64_t {
+  if (num_threads <= 1)
+    return perft(root, depth, generate);
+
+  // Split the tree breadth first until there are enough subtrees to keep
+  // every thread busy.
+  auto subtrees = std::vector<std::pair<State, int32_t>>{{root, depth}};
+  auto leaves = uint64_t{0};
+  while (subtrees.size() < 8 * static_cast<size_t>(num_threads)) {
+    auto next = std::vector<std::pair<State, int32_t>>{};
+    for (auto& [state, remaining] : subtrees) {
+      if (remaining <= 1 or is_drawn_out(state)) {
+        leaves += perft(state, remaining, generate);
+        continue;
+      }
+
+      for (auto action : generate(state))
+        next.emplace_back(dz::Game::apply_action(state, action), remaining - 1);
+    }
+
+    subtrees = std::move(next);
+    if (subtrees.empty())
+      return leaves;
+  }
+
+  auto next_index = std::atomic<size_t>{0};
+  auto nodes = std::atomic<uint64_t>{leaves};
+
+  auto threads = std::vector<std::thread>();
+  for (auto _ : std::views::iota(0, num_threads)) {
+    threads.emplace_back([&] {
+      for (auto i = next_index++; i < subtrees.size(); i = next_index++) {
+        auto& [state, remaining] = subtrees[i];
+        nodes += perft(state, remaining, generate);
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return nodes;
+}
+
+// Walks the tree of `reference` and checks that `candidate` generates the
+// same set of actions at every position.
+auto compare(const State& state, int32_t depth, Generator reference,
+             Generator candidate, uint64_t& num_positions) -> bool {
+  if (depth == 0 or is_drawn_out(state))
+    return true;
+
+  num_positions++;
+
+  auto expected = reference(state);
+  auto actual = candidate(state);
+  std::ranges::sort(expected);
+  std::ranges::sort(actual);
+
+  if (expected != actual) {
+    auto format_actions = [&state](const std::vector<dz::Action>& actions) {
+      auto text = std::string{};
+      for (auto action : actions)
+        text += std::format("{}({}) ", dz::format_action(state, action),
+                            action);
+      return text;
+    };
+
+    std::println("Mismatch at {}", dz::to_notation(state));
+    std::println("  reference: {}", format_actions(expected));
+    std::println("  candidate: {}", format_actions(actual));
+    return false;
+  }
+
+  for (auto action : expected)
+    if (not compare(dz::Game::apply_action(state, action), depth - 1,
+                    reference, candidate, num_positions))
+      return false;
+
+  return true;
+}
+
+auto main(int argc, char** argv) -> int {
+  auto depth = 5;
+  auto num_threads = 1;
+  auto generator = std::string_view{"list"};
+  auto divide = false;
+  auto diff = std::optional<std::pair<std::string_view, std::string_view>>{};
+  auto positions = std::vector<State>{};
+
+  for (auto i = 1; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--depth" and has_value)
+      depth = std::stoi(argv[++i]);
+    else if (flag == "--threads" and has_value)
+      num_threads = std::stoi(argv[++i]);
+    else if (flag == "--generator" and has_value)
+      generator = argv[++i];
+    else if (flag == "--divide")
+      divide = true;
+    else if (flag == "--diff" and i + 2 < argc) {
+      diff = {argv[i + 1], argv[i + 2]};
+      i += 2;
+    } else if (flag == "--position" and has_value) {
+      auto state = dz::from_notation(argv[++i]);
+      if (not state) {
+        std::println(std::cerr, "Invalid position {}.", argv[i]);
+        return -1;
+      }
+      positions.push_back(*state);
+    } else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  if (positions.empty()) {
+    positions.push_back(State{.player = dz::Player::First});
+    positions.push_back(State{.player = dz::Player::Second});
+  }
+
+  for (auto name : {generator, diff ? diff->first : generator,
+                    diff ? diff->second : generator}) {
+    if (not generators.contains(name)) {
+      std::println(std::cerr, "Unknown generator {}.", name);
+      return -1;
+    }
+  }
+
+  if (diff) {
+    auto reference = generators.at(diff->first);
+    auto candidate = generators.at(diff->second);
+    for (auto& state : positions) {
+      auto num_positions = uint64_t{0};
+      auto start = std::chrono::steady_clock::now();
+      auto matches = compare(state, depth, reference, candidate, num_positions);
+      auto elapsed = seconds_since(start);
+
+      std::println("{}: {} {} positions to depth {} in {:.3f}s",
+                   dz::to_notation(state), matches ? "matched" : "diverged",
+                   num_positions, depth, elapsed);
+      if (not matches)
+        return 1;
+    }
+    return 0;
+  }
+
+  auto generate = generators.at(generator);
+  auto kernels = generator == "batched-scalar"
+                     ? std::optional{dz::KernelSet::Scalar}
+                     : std::nullopt;
+  auto count = [&](const State& state, int32_t remaining) {
+    if (generator.starts_with("batched"))
+      return batched_perft(std::span(&state, 1), remaining, kernels);
+    return parallel_perft(state, remaining, generate, num_threads);
+  };
+
+  for (auto& state : positions) {
+    std::println("{}", dz::to_notation(state));
+
+    if (divide) {
+      for (auto action : generate(state)) {
+        auto nodes = count(dz::Game::apply_action(state, action), depth - 1);
+        std::println("  {}: {}", dz::format_action(state, action), nodes);
+      }
+    }
+
+    for (auto d : std::views::iota(1, depth + 1)) {
+      auto start = std::chrono::steady_clock::now();
+      auto nodes = count(state, d);
+      auto elapsed = seconds_since(start);
+
+      std::println("  depth {}: {} nodes in {:.3f}s ({:.0f} nodes/s)", d,
+                   nodes, elapsed, nodes / std::max(elapsed, 1e-9));
+    }
+  }
+}
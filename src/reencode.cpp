@@ -0,0 +1,122 @@
+#include <torch/torch.h>
+
+import az;
+import dz;
+import std;
+
+// Encodes the training samples of game records again with the current
+// `Game::encode_state`, so that a change of the features does not need new
+// self-play games.
+//
+// Usage: DamathZeroReencode OUTPUT RECORDS... [--threads N]
+//                           [--games-per-shard N]
+//
+// Records are read as a stream and replayed in parallel, `--games-per-shard`
+// games at a time. Every shard is saved as OUTPUT/samples_<k>.pt holding the
+// stacked features, values and policies, in the order of the games.
+
+struct Options {
+  std::vector<std::string> records;
+  int32_t num_threads = az::Topology::detect().num_actors();
+  int32_t games_per_shard = 10000;
+};
+
+using Sample = std::tuple<torch::Tensor, torch::Tensor, torch::Tensor>;
+
+// The samples of every game of `games`, in order, replayed on `num_threads`
+// threads.
+auto encode(std::span<const az::GameRecord> games, int32_t num_threads)
+    -> std::vector<Sample> {
+  auto samples = std::vector<std::vector<Sample>>(games.size());
+  auto next_game = std::atomic<size_t>{0};
+
+  auto threads = std::vector<std::thread>{};
+  for (auto _ : std::views::iota(0, num_threads)) {
+    threads.emplace_back([&] {
+      torch::NoGradGuard no_grad;
+      for (auto game = next_game++; game < games.size(); game = next_game++)
+        samples[game] = az::training_samples<dz::Game>(games[game]);
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return samples | std::views::join | std::ranges::to<std::vector>();
+}
+
+auto save_shard(const std::vector<Sample>& samples, std::string_view path)
+    -> void {
+  auto features = std::vector<torch::Tensor>{};
+  auto values = std::vector<torch::Tensor>{};
+  auto policies = std::vector<torch::Tensor>{};
+  for (auto& [feature, value, policy] : samples) {
+    features.push_back(feature);
+    values.push_back(value);
+    policies.push_back(policy);
+  }
+
+  torch::save(std::vector<torch::Tensor>{torch::stack(features),
+                                         torch::stack(values),
+                                         torch::stack(policies)},
+              std::string(path));
+}
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 3) {
+    std::println(std::cerr, "Expected the output directory and records.");
+    return -1;
+  }
+
+  auto options = Options{};
+  for (auto i = 2; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--threads" and has_value)
+      options.num_threads = std::stoi(argv[++i]);
+    else if (flag == "--games-per-shard" and has_value)
+      options.games_per_shard = std::stoi(argv[++i]);
+    else if (flag.starts_with("--")) {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    } else
+      options.records.emplace_back(flag);
+  }
+
+  auto output = std::filesystem::path(argv[1]);
+  std::filesystem::create_directories(output);
+
+  auto num_threads = std::max(1, options.num_threads);
+  auto num_games = int64_t{0};
+  auto num_samples = int64_t{0};
+  auto num_shards = 0;
+
+  auto games = std::vector<az::GameRecord>{};
+  auto flush = [&] {
+    auto samples = encode(games, num_threads);
+    num_games += std::ssize(games);
+    games.clear();
+    if (samples.empty())
+      return;
+
+    num_samples += std::ssize(samples);
+    save_shard(samples,
+               (output / std::format("samples_{}.pt", num_shards++)).string());
+    std::println(std::cerr, "Encoded {} samples of {} games.", num_samples,
+                 num_games);
+  };
+
+  for (auto& path : options.records) {
+    auto reader = az::RecordReader(path);
+    while (auto record = reader.next()) {
+      games.push_back(std::move(*record));
+      if (std::ssize(games) == options.games_per_shard)
+        flush();
+    }
+  }
+  flush();
+
+  std::println("{} samples of {} games in {} shards.", num_samples, num_games,
+               num_shards);
+}
@@ -0,0 +1,47 @@
+import dz;
+import std;
+
+// Generates the endgame tablebase probed by `Game::get_outcome`.
+//
+// Usage: DamathZeroTablebase OUTPUT [--pieces N] [--threads N]
+//
+// Solving keeps the last layer of every material in memory, about 1.7GB for
+// three pieces and 650GB for four. Every layer is written to OUTPUT as soon
+// as it is solved.
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 2) {
+    std::println(std::cerr, "Usage: {} OUTPUT [--pieces N] [--threads N]",
+                 argv[0]);
+    return -1;
+  }
+
+  auto output = std::string_view{argv[1]};
+  auto max_pieces = 2;
+  auto num_threads = static_cast<int32_t>(std::thread::hardware_concurrency());
+
+  for (auto i = 2; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    auto has_value = i + 1 < argc;
+    if (flag == "--pieces" and has_value)
+      max_pieces = std::stoi(argv[++i]);
+    else if (flag == "--threads" and has_value)
+      num_threads = std::stoi(argv[++i]);
+    else {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    }
+  }
+
+  if (max_pieces < 2 or max_pieces > dz::MaxTablebasePieces) {
+    std::println(std::cerr, "The number of pieces must be within [2, {}].",
+                 dz::MaxTablebasePieces);
+    return -1;
+  }
+
+  std::println("Solving up to {} pieces takes up to {:.1f}GB of memory.",
+               max_pieces, dz::Retrograde::max_memory(max_pieces) / 1e9);
+
+  auto retrograde = dz::Retrograde{max_pieces};
+  retrograde.solve(output, std::max(num_threads, 1));
+}
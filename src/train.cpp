@@ -1,7 +1,25 @@
 import dz;
 import std;
 
+// Usage: DamathZeroTrainer [MODEL [TABLEBASE]] [--records PATH]
+//
+// Continues training MODEL when given, otherwise starts from a fresh network.
+// With --records every self-play and evaluation game is appended to PATH.
+
 auto main(int argc, char** argv) -> int {
+  auto arguments = std::vector<std::string_view>{};
+  auto game_records_path = std::optional<std::string>{};
+  for (auto i = 1; i < argc; i++) {
+    auto flag = std::string_view{argv[i]};
+    if (flag == "--records" and i + 1 < argc)
+      game_records_path = argv[++i];
+    else if (flag.starts_with("--")) {
+      std::println(std::cerr, "Unknown flag {}.", flag);
+      return -1;
+    } else
+      arguments.push_back(flag);
+  }
+
   auto damathzero = dz::DamathZero{{
       .batch_size = 64,
       .num_training_epochs = 4,
@@ -9,24 +27,27 @@ auto main(int argc, char** argv) -> int {
       .num_self_play_actors = 6,
       .num_self_play_iterations = 100,
       .num_self_play_simulations = 60,
+      .num_concurrent_self_play_games = 32,
+      // A fresh network learns its first iteration from the classical engine.
+      .bootstrap_policy = dz::alpha_beta_policy({.max_depth = 4}),
+      .num_bootstrap_iterations = arguments.empty() ? 1 : 0,
       .num_evaluation_actors = 5,
       .num_evaluation_iterations = 10,
       .num_evaluation_simulations = 1000,
       .device = dz::DeviceType::CPU,
+      .game_records_path = game_records_path,
   }};
 
-  auto model_config = dz::Model::Config{
-      .action_size = dz::Game::ActionSize,
-      .num_blocks = 10,
-      .num_attention_head = 4,
-      .embedding_dim = 64,
-      .mlp_hidden_size = 128,
-      .mlp_dropout_prob = 0.1,
-  };
+  auto model_config = dz::Model::Config{};
 
   std::optional<std::shared_ptr<dz::Model>> previous_model = std::nullopt;
-  if (argc > 1) {
-    previous_model = dz::load_model(argv[1], model_config);
+  if (arguments.size() > 0) {
+    previous_model = dz::load_model(arguments[0], model_config);
+  }
+
+  // Endgames in the tablebase end self-play games and searches early.
+  if (arguments.size() > 1) {
+    dz::use_tablebase(dz::Tablebase::load(arguments[1]));
   }
 
   auto model = damathzero.learn(model_config, previous_model);